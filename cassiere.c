@@ -1,8 +1,8 @@
 #include "cassiere.h"
 #include "cliente.h"
 #include "defines.h"
-#include "utils.h" /* safe_seed() */
 #include "direttore.h"
+#include "supermercato.h" /* cambia_coda_supermercato() */
 #include "stopwatch.h"
 #include "logger.h"
 #include <pthread.h>
@@ -11,25 +11,28 @@
 #include <unistd.h>
 #include <execinfo.h>
 
-static void set_active(cassiere_t *cassiere, int active) {
-  pthread_mutex_lock_safe(&cassiere->mtx);
-  cassiere->active = active;
-  pthread_cond_signal(&cassiere->not_empty_cond); /* risveglia il thread cassiere */
-  pthread_mutex_unlock_safe(&cassiere->mtx);
-}
-
-static void set_closing(cassiere_t *cassiere, int closing) {
+/*
+ * Determina se la cassa è aperta e non in chiusura, leggendo entrambi i campi
+ * con un'unica acquisizione del mutex del cassiere.
+ */
+static int is_cassa_running(cassiere_t *cassiere) {
   pthread_mutex_lock_safe(&cassiere->mtx);
-  cassiere->closing = closing;
-  pthread_cond_signal(&cassiere->not_empty_cond); /* risveglia il thread cassiere */
+  int running = cassiere->active && !cassiere->closing;
   pthread_mutex_unlock_safe(&cassiere->mtx);
+  return running;
 }
 
-static void set_allocated(cassiere_t *cassiere, int allocated) {
-  pthread_mutex_lock_safe(&cassiere->mtx);
-  cassiere->allocated = allocated;
-  pthread_cond_signal(&cassiere->not_empty_cond); /* risveglia il thread cassiere */
-  pthread_mutex_unlock_safe(&cassiere->mtx);
+/*
+ * Operazioni del cassiere al termine di ogni intervallo di comunicazione:
+ * i clienti in coda valutano se spostarsi in una coda più corta (vedi
+ * cambia_coda_supermercato()), poi il numero di clienti in coda è comunicato
+ * al direttore.
+ */
+static void fine_intervallo(cassiere_t *cassiere) {
+  if (cassiere->supermercato != NULL) {
+    cambia_coda_supermercato(cassiere->supermercato, cassiere);
+  }
+  comunica_numero_clienti(cassiere, ilist_size(cassiere->clienti));
 }
 
 static int diff_ms(struct timespec start, struct timespec end) {
@@ -37,81 +40,87 @@ static int diff_ms(struct timespec start, struct timespec end) {
 }
 
 /*
- * Thread di lavoro dei cassieri.
- * Il thread esegue il loop mentre is_cassa_closing(cassiere) == 0.
- * Quando is_cassa_closing(cassiere) = 0, la funzione termina con successo.
+ * Attende che la cassa sia aperta (vedi open_cassa()) o che il cassiere sia
+ * terminato (vedi terminate_cassa()). Mentre la cassa è chiusa il thread di
+ * lavoro resta sospeso sulla variabile di condizione del cassiere.
+ * Restituisce: un valore != 0 se la cassa è stata aperta, 0 se il thread
+ * deve terminare.
  */
-static void *working_thread(void *arg) {
-  assert(arg != NULL);
-  cassiere_t *cassiere = (cassiere_t*)arg;
+static int attendi_apertura(cassiere_t *cassiere) {
+  pthread_mutex_lock_safe(&cassiere->mtx);
+  while (!cassiere->active && !cassiere->terminato) {
+    pthread_cond_wait(&cassiere->stato_cond, &cassiere->mtx);
+  }
+  int aperta = cassiere->active;
+  pthread_mutex_unlock_safe(&cassiere->mtx);
+  return aperta;
+}
+
+/*
+ * Periodo di apertura della cassa: il cassiere serve i clienti in coda
+ * mentre is_cassa_running(cassiere) != 0, poi avvisa i clienti rimasti in
+ * coda e segna la cassa come chiusa.
+ */
+static void servi_clienti(cassiere_t *cassiere, stopwatch_t *opening_time,
+    stopwatch_t *service_stopwatch) {
   printf("CASSA %d: attivata\n", cassa_id(cassiere));
 
-  /* 
-   * Ottiene un intero incrementale in maniera thread-safe da usare per la
-   * generazione di numeri casuali.
-   */
-  unsigned int seed = safe_seed();
+  /* Completamento della richiesta di apertura */
+  pthread_mutex_lock_safe(&cassiere->mtx);
+  cassa_fatto_t fatto = cassiere->aperta_fatto;
+  void *fatto_arg = cassiere->aperta_arg;
+  cassiere->aperta_fatto = NULL;
+  pthread_mutex_unlock_safe(&cassiere->mtx);
+  if (fatto != NULL) {
+    fatto(cassiere, fatto_arg);
+  }
 
-  struct timespec ts, timer_start, timer_end, twait, client_start, client_end;
-  /* generazione tempo di servizio casuale nel range 20-80 ms*/
-  int service_time = 20 + rand_r(&seed) % (80-20);
+  struct timespec ts, timer_start, timer_end;
+  /* generazione tempo di servizio casuale nel range 20-80 ms: il generatore
+   * del cassiere è usato soltanto dal thread della cassa aperta */
+  int service_time = 20 + rng_range(&cassiere->rng, 80-20);
   int waiting_time;
-  int remaining_time = cassiere->s; 
+  /* le attese del thread sono in millisecondi reali (vedi stopwatch_real_ms()) */
+  int intervallo = stopwatch_real_ms(cassiere->s);
+  int remaining_time = intervallo;
+  cliente_t *cliente = NULL; /* cliente in servizio */
 
-  pthread_mutex_lock_safe(&cassiere->mtx);
   clock_gettime(CLOCK_REALTIME, &timer_start); /* Inizializza il timer */
 
   /* Fa partire il cronometro per il periodo di apertura della cassa */
-  stopwatch_t *opening_time = stopwatch_create(STOPWATCH_STARTING);
-  /* Crea il cronometro per misurare il tempo per servire il cliente*/
-  stopwatch_t *service_stopwatch = stopwatch_create(STOPWATCH_STOPPED);
+  stopwatch_start(opening_time);
 
   /* thread loop */
-  while(!cassiere->closing && cassiere->active) {
+  while(is_cassa_running(cassiere)) {
     /*
      * Nota: la coda clienti è acceduta concorrentemente dal cassiere e dai
      * thread che gestiscono la creazione e la rilocazione dei clienti.
-     * Pertanto l'unico thread che elimina elementi dalla coda è il cassiere e
-     * non c'è rischio che la condizione !queue_empty(cassiere->clienti) cambi
-     * senza che il cassiere processi un nuovo cliente. L'utilizzo di chiamate
-     * "atomiche" (sincronizzate dalla coda stessa), è quindi sicuro e non è
-     * necessario mantenere il lock sulla coda.
+     * La coda è una lista intrusiva (ilist_t): inserimenti ed estrazioni non
+     * allocano memoria, gli inserimenti sono lock-free e la lunghezza della
+     * coda è letta senza lock. I clienti inseriti dall'ultima estrazione sono
+     * collegati alla coda dalla successiva ilist_pop_wait().
      * Il mutex cassiere->mtx è utilizzato per sincronizzare soltanto l'accesso
      * ai campi active e closing del cassiere.
      */
-    while(queue_empty(cassiere->clienti) 
-        && !cassiere->closing 
-        && cassiere->active) {
-
-      if (remaining_time <= 0) {
-        /* Comunica il numero di clienti in coda al direttore */
-        comunica_numero_clienti(cassiere, queue_size(cassiere->clienti));
-        clock_gettime(CLOCK_REALTIME, &timer_start);
-        remaining_time = cassiere->s;
-      }
-
-      /* Rimane in attesa di nuovi clienti da servire al più 
-       * remaining_time millisecondi, tempo dopo il quale è necessario
-       * contattare il direttore.
-       */
-      clock_gettime(CLOCK_REALTIME, &twait);
-      twait.tv_sec += (remaining_time / 1000);
-      twait.tv_nsec += (remaining_time % 1000)*1000*1000;
-
-      int res = pthread_cond_timedwait(&cassiere->not_empty_cond, &cassiere->mtx, &twait);
-      if (res == ETIMEDOUT) {
-        /* Comunica il numero di clienti in coda al direttore */
-        comunica_numero_clienti(cassiere, queue_size(cassiere->clienti));
-        clock_gettime(CLOCK_REALTIME, &timer_start);
-        remaining_time = cassiere->s;
-      }
+
+    /* Comunica con il direttore se il tempo è scaduto */
+    if (remaining_time <= 0) {
+      /* Jockeying e comunicazione del numero di clienti in coda al direttore */
+      fine_intervallo(cassiere);
+
+      /* Resetta il timer per la comunicazione con il direttore */
+      clock_gettime(CLOCK_REALTIME, &timer_start);
+      remaining_time = intervallo;
     }
 
-    /* Controlla che nel frattempo la cassa non sia stata chiusa.
-     * Nota: Il lock è stato acquisito dalla wait 
+    /* Rimane in attesa di nuovi clienti da servire al più remaining_time
+     * millisecondi, tempo dopo il quale è necessario contattare il direttore.
+     * La chiusura della cassa interrompe l'attesa (vedi close_cassa()).
      */
-    if (cassiere->closing || !cassiere->active) {
-      break;
+    ilist_node_t *node = ilist_pop_wait(cassiere->clienti, remaining_time);
+    cliente = node != NULL ? ilist_entry(node, cliente_t, link) : NULL;
+    if (cliente != NULL) {
+      atomic_fetch_sub(&cassiere->prodotti_in_coda, cliente->products);
     }
 
     /* Sottrae dal tempo rimanente il tempo impiegato in attesa di nuovi clienti */
@@ -119,32 +128,36 @@ static void *working_thread(void *arg) {
     remaining_time -= diff_ms(timer_start, timer_end);
     clock_gettime(CLOCK_REALTIME, &timer_start);
 
+    if (cliente == NULL) {
+      continue; /* tempo scaduto o attesa interrotta: ricontrolla lo stato */
+    }
+
+    /* Controlla che nel frattempo la cassa non sia stata chiusa: in tal caso
+     * il cliente estratto viene avvisato insieme a quelli ancora in coda.
+     */
+    if (!is_cassa_running(cassiere)) {
+      break;
+    }
+
     /* Comunica con il direttore se il tempo è scaduto */
     if (remaining_time <= 0) {
-      /* Comunica il numero di clienti in coda al direttore */
-      comunica_numero_clienti(cassiere, queue_size(cassiere->clienti));
+      /* Jockeying e comunicazione del numero di clienti in coda al direttore */
+      fine_intervallo(cassiere);
 
       /* Resetta il timer per la comunicazione con il direttore */
       clock_gettime(CLOCK_REALTIME, &timer_start);
-      remaining_time = cassiere->s;
+      remaining_time = intervallo;
     }
 
-
-    assert(queue_size(cassiere->clienti) > 0);
-    cliente_t *cliente = (cliente_t*) queue_top(cassiere->clienti);
     stopwatch_start(service_stopwatch);
 
-    /* Rilascia il mutex prima che il thread si blocchi */
-    pthread_mutex_unlock_safe(&cassiere->mtx);
-    clock_gettime(CLOCK_REALTIME, &client_start);
-
     /* Inizializzazione timespec e calcolo tempo di servizio del cassiere:
      * il tempo di servizio (in nanosecondi) è calcolato moltiplicando il numero
      * di prodotti selezionati dal cliente con il tempo di latenza di un singolo
      * prodotto. Il totale è poi sommato al tempo di servizio costante del
-     * cassiere.
+     * cassiere e convertito in tempo reale (fattore di scala SPEED).
      */
-    waiting_time = (cliente->products*cassiere->tp + service_time); // ms
+    waiting_time = stopwatch_real_ms(cliente->products*cassiere->tp + service_time); // ms
     ts.tv_sec = waiting_time / 1000; // secondi
     ts.tv_nsec = (waiting_time % 1000)*1000*1000; // nanosecondi
 
@@ -161,10 +174,9 @@ static void *working_thread(void *arg) {
       ts.tv_nsec = ((waiting_time - remaining_time) % 1000)*1000*1000; // nanosecondi
       nanosleep(&ts, &ts); 
 
-      /* Comunica il numero di clienti in coda al direttore */
-      pthread_mutex_lock_safe(&cassiere->mtx);
-      comunica_numero_clienti(cassiere, queue_size(cassiere->clienti));
-      pthread_mutex_unlock_safe(&cassiere->mtx);
+      /* Comunica il numero di clienti in coda al direttore: la lunghezza della
+       * coda è letta senza acquisire lock. */
+      fine_intervallo(cassiere);
 
       /* Imposta il tempo di servizio rimanente per processare il cliente */
       ts.tv_sec = remaining_time / 1000; // secondi
@@ -172,27 +184,24 @@ static void *working_thread(void *arg) {
 
       /* Resetta il timer per la comunicazione con il direttore */
       clock_gettime(CLOCK_REALTIME, &timer_start);
-      remaining_time = cassiere->s;
+      remaining_time = intervallo;
     }
 
     nanosleep(&ts, &ts); /* Servi il cliente */
 
-    cliente_t *servito = queue_pop(cassiere->clienti);
-    assert(cliente == servito);
-
     /* Aggiorna statistiche cassiere */
     cassiere->clienti_serviti++;
-    cassiere->prodotti_venduti += servito->products;
+    cassiere->prodotti_venduti += cliente->products;
 
     /* Informa il thread cliente che è stato servito */
-    set_servito(servito, 1);
+    set_servito(cliente, 1);
+    cliente = NULL;
     int t = stopwatch_end(service_stopwatch);
     log_write("CASSA %d: tempo di servizio cliente = %.3f\n",
         cassa_id(cassiere),
         (double)t/1000);
     cassiere->tempo_medio += t;
 
-    clock_gettime(CLOCK_REALTIME, &client_end);
     clock_gettime(CLOCK_REALTIME, &timer_end);
 
     /* Verifica che lo scarto tra il tempo impiegato e il tempo teorico di servizio 
@@ -203,30 +212,14 @@ static void *working_thread(void *arg) {
     /* Sottrae dal tempo rimanente il tempo impiegato per processare il cliente */
     remaining_time -= diff_ms(timer_start, timer_end);
     clock_gettime(CLOCK_REALTIME, &timer_start);
-
-    /* Riacquisisce il lock sul cassiere in modo da poter verificare la
-     * condizione del ciclo While in modo sicuro
-     */
-    pthread_mutex_lock_safe(&cassiere->mtx);
   }
 
-  /* segnalazione chiusura cassa ai clienti */
-  while (!queue_empty(cassiere->clienti)) {
-    cliente_t *c = queue_pop(cassiere->clienti);
-
-    pthread_mutex_lock_safe(&c->mtx);
-    pthread_cond_signal(&c->servito_cond);
-    pthread_mutex_unlock_safe(&c->mtx);
-  }
-
-  cassiere->active = 0;
-  cassiere->closing = 0;
-  cassiere->numero_chiusure++;
-
-  /* Rilascia il lock sul cassiere */
-  pthread_mutex_unlock_safe(&cassiere->mtx);
-
+  /* La coda è svuotata con un'unica acquisizione del lock: nessun cliente
+   * può essere accodato alla cassa, già rimossa dalle casse aperte. */
+  ilist_node_t *node = ilist_drain(cassiere->clienti);
 
+  /* Le statistiche sono aggiornate prima di segnare la cassa come chiusa:
+   * chi attende la chiusura (vedi wait_cassa()) le legge senza lock. */
   int parziale = stopwatch_end(opening_time);
   log_write("CASSA %d: tempo parziale di apertura = %.3f\n",
       cassa_id(cassiere),
@@ -237,6 +230,54 @@ static void *working_thread(void *arg) {
     cassiere->tempo_medio /= cassiere->clienti_serviti;
   }
 
+  pthread_mutex_lock_safe(&cassiere->mtx);
+  cassiere->active = 0;
+  cassiere->closing = 0;
+  cassiere->numero_chiusure++;
+  fatto = cassiere->chiusa_fatto;
+  fatto_arg = cassiere->chiusa_arg;
+  cassiere->chiusa_fatto = NULL;
+  pthread_cond_broadcast(&cassiere->stato_cond);
+  pthread_mutex_unlock_safe(&cassiere->mtx);
+
+  /* Completamento della richiesta di chiusura */
+  if (fatto != NULL) {
+    fatto(cassiere, fatto_arg);
+  }
+
+  /* Segnalazione chiusura cassa ai clienti: la notifica non acquisisce lock
+   * e i clienti risvegliati possono subito mettersi in coda presso un'altra
+   * cassa. Un cliente notificato non è più acceduto. */
+  if (cliente != NULL) { /* cliente estratto ma non servito */
+    notifica_cliente(cliente);
+  }
+  while (node != NULL) {
+    ilist_node_t *next = node->next; /* il nodo può essere reinserito */
+    cliente_t *rilocato = ilist_entry(node, cliente_t, link);
+    atomic_fetch_sub(&cassiere->prodotti_in_coda, rilocato->products);
+    notifica_cliente(rilocato);
+    node = next;
+  }
+}
+
+/*
+ * Thread di lavoro dei cassieri.
+ * Il thread è creato alla prima apertura della cassa e resta in vita fino a
+ * terminate_cassa(): a ogni apertura serve i clienti (vedi servi_clienti()),
+ * poi resta sospeso finchè la cassa non viene riaperta. Aprire e chiudere una
+ * cassa non crea né termina thread.
+ */
+static void *working_thread(void *arg) {
+  assert(arg != NULL);
+  cassiere_t *cassiere = (cassiere_t*)arg;
+
+  /* I cronometri sono riutilizzati a ogni periodo di apertura */
+  stopwatch_t *opening_time = stopwatch_create(STOPWATCH_STOPPED);
+  stopwatch_t *service_stopwatch = stopwatch_create(STOPWATCH_STOPPED);
+
+  while (attendi_apertura(cassiere)) {
+    servi_clienti(cassiere, opening_time, service_stopwatch);
+  }
 
   stopwatch_free(opening_time);
   stopwatch_free(service_stopwatch);
@@ -293,8 +334,16 @@ void init_cassiere(cassiere_t *cassiere, int tp, int s) {
   cassiere->active = 0; /* cassiere inizialmente non attivo */
   cassiere->closing = 0; /* cassiere inizialmente non in chiusura */
   cassiere->allocated = 0; /* thread cassiere ancora non inizializzato */
+  cassiere->terminato = 0;
+  cassiere->aperta_fatto = NULL;
+  cassiere->aperta_arg = NULL;
+  cassiere->chiusa_fatto = NULL;
+  cassiere->chiusa_arg = NULL;
+  atomic_init(&cassiere->prodotti_in_coda, 0);
   cassiere->tp = tp;
   cassiere->s = s;
+  cassiere->supermercato = NULL;
+  rng_init(&cassiere->rng, RNG_CASSIERI, cassiere->id);
   cassiere->clienti_serviti =  0;
   cassiere->numero_chiusure =  0;
   cassiere->prodotti_venduti =  0;
@@ -302,46 +351,66 @@ void init_cassiere(cassiere_t *cassiere, int tp, int s) {
   cassiere->tempo_medio = 0;
 
   /* crea la coda clienti - inizialmente vuota */
-  cassiere->clienti = queue_create();
+  cassiere->clienti = ilist_create();
   pthread_mutex_init_ec(&cassiere->mtx, NULL);
-  pthread_cond_init(&cassiere->not_empty_cond, NULL);
+  pthread_cond_init(&cassiere->stato_cond, NULL);
 }
 
 /*
- * Apre una cassa attivando il working thread di un cassiere.
+ * Apre una cassa risvegliando il working thread del cassiere, creato alla
+ * prima apertura.
  * Successivamente alla chiamata is_cassa_active(cassiere) != 0, e il thread
- * cassiere->thread è attivo.
+ * cassiere->thread è attivo. La funzione non è bloccante: se 'fatto' non è
+ * NULL, è chiamata con argomento 'arg' quando il thread inizia a servire i
+ * clienti.
  *
  * Restituisce: 0 se la cassa è stata aperta correttamente e un valore != 0
- * altrimenti.
+ * altrimenti (in tal caso 'fatto' non è chiamata).
  */
-int open_cassa(cassiere_t *cassiere) {
+int open_cassa(cassiere_t *cassiere, cassa_fatto_t fatto, void *arg) {
   assert(cassiere != NULL);
   assert(!is_cassa_active(cassiere));
   assert(!is_cassa_closing(cassiere));
 
-  if (cassiere == NULL || is_cassa_active(cassiere)) {
+  if (cassiere == NULL) {
     return -1;
   }
 
-  set_active(cassiere, 1);
-  set_closing(cassiere, 0);
-  cassiere->allocated = 1;
-  int s = pthread_create(&cassiere->thread, (void*)NULL, &working_thread, (void*)cassiere);
-  if (s != 0) {
-    handle_error("pthread_create cassiere");
+  pthread_mutex_lock_safe(&cassiere->mtx);
+  if (cassiere->active || cassiere->terminato) {
+    pthread_mutex_unlock_safe(&cassiere->mtx);
+    return -1;
+  }
+  cassiere->active = 1;
+  cassiere->closing = 0;
+  cassiere->aperta_fatto = fatto;
+  cassiere->aperta_arg = arg;
+  if (!cassiere->allocated) {
+    cassiere->allocated = 1;
+    int s = pthread_create(&cassiere->thread, (void*)NULL, &working_thread, (void*)cassiere);
+    if (s != 0) {
+      handle_error("pthread_create cassiere");
+    }
   }
+  else {
+    /* il thread, sospeso in attendi_apertura(), inizia a servire i clienti */
+    pthread_cond_broadcast(&cassiere->stato_cond);
+  }
+  pthread_mutex_unlock_safe(&cassiere->mtx);
 
   return 0;
 }
 
 /*
- * Chiude una cassa causando la terminazione del working thread del cassiere.
- * La terminazione istantanea non è garantita, ma avviene dopo aver servito il
- * cliente corrente.
+ * Chiude una cassa: il working thread del cassiere termina il periodo di
+ * apertura e resta sospeso fino alla successiva apertura.
+ * La chiusura istantanea non è garantita, ma avviene dopo aver servito il
+ * cliente corrente. La funzione non è bloccante: se 'fatto' non è NULL, è
+ * chiamata con argomento 'arg' quando la cassa è effettivamente chiusa
+ * (vedi anche wait_cassa()).
  * Se il cassiere non è attivo, la funzione termina con successo.
  */
-int close_cassa(cassiere_t *cassiere) {
+int close_cassa(cassiere_t *cassiere, cassa_fatto_t fatto, void *arg) {
   assert(cassiere != NULL);
   assert(is_cassa_active(cassiere));
   assert(!is_cassa_closing(cassiere));
@@ -351,57 +420,112 @@ int close_cassa(cassiere_t *cassiere) {
   }
 
   /* Informa il thread del cassiere di fermarsi */
-  // cassiere->active = 0;
-  set_closing(cassiere, 1);
+  pthread_mutex_lock_safe(&cassiere->mtx);
+  cassiere->closing = 1;
+  cassiere->chiusa_fatto = fatto;
+  cassiere->chiusa_arg = arg;
+  pthread_mutex_unlock_safe(&cassiere->mtx);
+  ilist_interrupt(cassiere->clienti); /* risveglia il thread cassiere */
   return 0;
 }
 
 /*
- * Attende la chiusura di una cassa invocando pthread_join sul thread di lavoro
- * del cassiere.
- * Se il thread è già terminato, la funzione termina con successo.
+ * Attende la chiusura effettiva di una cassa, cioè la fine del periodo di
+ * apertura del working thread. Più thread possono attendere la stessa cassa.
+ * Se la cassa è già chiusa, la funzione termina con successo.
  * La funzione wait_cassa() non chiude la cassa, quindi per non aspettare
  * indefinitivamente è necessario chiamare prima close_cassa().
  */
 void wait_cassa(cassiere_t *cassiere) {
   assert(cassiere != NULL);
-  /* la cassa deve essere chiusa oppure in chiusura */
-  // assert(is_cassa_closing(cassiere) || !is_cassa_active(cassiere));
 
-  /* se il thread cassiere non è stato creato, non fare niente */
-  if (!cassiere->allocated) {
-    assert(!is_cassa_closing(cassiere));
-    assert(!is_cassa_active(cassiere));
-    return;
+  pthread_mutex_lock_safe(&cassiere->mtx);
+  while (cassiere->active) {
+    pthread_cond_wait(&cassiere->stato_cond, &cassiere->mtx);
   }
+  pthread_mutex_unlock_safe(&cassiere->mtx);
+}
 
-  int s = pthread_join(cassiere->thread, NULL);
-  if (s == ESRCH) { /* (s == 3) no thread with the specified ID could be found */
-    /* il thread del cassiere richiesto ha già terminato */
-    return;
-  }
-  if (s != 0) { /* altri tipi di errore */
-    handle_error("pthread_join cassiere");
-  }
+/*
+ * Termina il working thread di un cassiere, attendendone la terminazione con
+ * pthread_join. La cassa deve essere chiusa e non può più essere riaperta.
+ * Se il thread non è mai stato creato, la funzione termina con successo.
+ */
+void terminate_cassa(cassiere_t *cassiere) {
+  assert(cassiere != NULL);
 
-  set_allocated(cassiere, 0);
+  pthread_mutex_lock_safe(&cassiere->mtx);
+  assert(!cassiere->active);
+  cassiere->terminato = 1;
+  pthread_cond_broadcast(&cassiere->stato_cond);
+  int allocated = cassiere->allocated;
+  cassiere->allocated = 0;
+  pthread_mutex_unlock_safe(&cassiere->mtx);
+
+  if (allocated) {
+    int s = pthread_join(cassiere->thread, NULL);
+    if (s != 0) {
+      handle_error("pthread_join cassiere");
+    }
+  }
 }
 
 /*
  * Aggiunge un cliente alla coda clienti di 'cassiere'.
- * -- L'accesso alla coda è sincronizzato dalla struttura dati queue_t. --
+ * -- Il collegamento nella coda è contenuto nel cliente (cliente->link),
+ * quindi l'inserimento non alloca memoria e non acquisisce il lock della coda
+ * (vedi ilist_push()). Se il thread cassiere è in attesa di nuovi clienti,
+ * viene risvegliato. --
  */
 void add_cliente(cassiere_t *cassiere, cliente_t *cliente) {
   assert(cassiere != NULL && cliente != NULL);
-  pthread_mutex_lock_safe(&cassiere->mtx);
-
-  queue_push(cassiere->clienti, (void*)cliente);
   cliente->cassiere = cassiere;
-  /* segnala il cassiere che ci sono nuovi clienti da servire */
-  pthread_cond_signal(&cassiere->not_empty_cond); 
-
-  pthread_mutex_unlock_safe(&cassiere->mtx);
+  /* i prodotti sono contati prima dell'inserimento, in modo che il cassiere
+   * non possa sottrarli prima che siano stati aggiunti */
+  atomic_fetch_add(&cassiere->prodotti_in_coda, cliente->products);
+  ilist_push(cassiere->clienti, &cliente->link);
 }
 
+/*
+ * Rimuove un cliente dalla coda di 'cassiere' in tempo costante, senza
+ * attendere che il cassiere lo estragga.
+ * Restituisce: 0 se il cliente è stato rimosso, -1 se il cliente non è in
+ * coda alla cassa (ad esempio perchè il cassiere ha già iniziato a servirlo o
+ * perchè la cassa è stata chiusa).
+ */
+int remove_cliente(cassiere_t *cassiere, cliente_t *cliente) {
+  assert(cassiere != NULL && cliente != NULL);
+  if (ilist_remove(cassiere->clienti, &cliente->link) != 0) {
+    return -1;
+  }
+  atomic_fetch_sub(&cassiere->prodotti_in_coda, cliente->products);
+  return 0;
+}
 
+/*
+ * Stima il tempo necessario a servire i clienti in coda a 'cassiere', come
+ * somma dei prodotti in coda per il tempo di gestione di un prodotto.
+ * La stima è letta senza acquisire lock e può essere momentaneamente
+ * imprecisa durante gli inserimenti e le estrazioni concorrenti.
+ */
+int lavoro_atteso(cassiere_t *cassiere) {
+  assert(cassiere != NULL);
+  return atomic_load_explicit(&cassiere->prodotti_in_coda, memory_order_relaxed)*cassiere->tp;
+}
 
+/*
+ * Scrive sul file di log le statistiche complessive del cassiere.
+ */
+void log_cassiere(const cassiere_t *cassiere) {
+  assert(cassiere != NULL);
+  log_write("CASSA %d: prodotti venduti = %d\n",
+      cassa_id(cassiere), cassiere->prodotti_venduti);
+  log_write("CASSA %d: clienti serviti = %d\n",
+      cassa_id(cassiere), cassiere->clienti_serviti);
+  log_write("CASSA %d: numero chiusure = %d\n",
+      cassa_id(cassiere), cassiere->numero_chiusure);
+  log_write("CASSA %d: tempo totale = %.3f\n",
+      cassa_id(cassiere), (double)cassiere->tempo_totale/1000);
+  log_write("CASSA %d: tempo medio servizio = %.3f\n",
+      cassa_id(cassiere), (double)cassiere->tempo_medio/1000);
+}
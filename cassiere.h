@@ -2,8 +2,18 @@
 #define _CASSIERE_H_
 #include <pthread.h>
 #include <stdlib.h>
-#include "queue.h"
+#include "ilist.h"
 #include "cliente.h"
+#include "rng.h"
+
+struct cassiere;
+
+/*
+ * Funzione di completamento di una richiesta di apertura o chiusura di una
+ * cassa (vedi open_cassa() e close_cassa()): è chiamata dal thread del
+ * cassiere, senza lock acquisiti, quando la richiesta è stata eseguita.
+ */
+typedef void (*cassa_fatto_t)(struct cassiere *cassiere, void *arg);
 
 /* Contiene le informazioni relative a un cassiere di un supermercato */
 typedef struct cassiere {
@@ -12,12 +22,20 @@ typedef struct cassiere {
   int active;       /* indica se la cassa è aperta (0 chiusa, != 0 aperta) */
   int closing;      /* indica se la cassa è in chiusura (!= 0 in chiusura, 0 altrimenti) */
   int allocated;    /* indica se il thread cassiere è stato creato */
+  int terminato;    /* indica se il thread cassiere deve terminare */
   int tp;           /* tempo di gestione del singolo prodotto dal cassiere */
   int s;            /* intervallo di comunicazione con il direttore */
+  rng_t rng;        /* generatore dei tempi di servizio (flusso dell'id) */
+  struct supermercato *supermercato; /* supermercato della cassa (NULL se nessuno) */
   /* synchronized fields*/
   pthread_mutex_t mtx; /* mutex per la sincronizzazione dello stato */
-  pthread_cond_t not_empty_cond;
-  queue_t *clienti; /* clienti in coda alla cassa */
+  pthread_cond_t stato_cond; /* segnalata all'apertura, alla chiusura e alla terminazione */
+  cassa_fatto_t aperta_fatto;  /* completamento dell'apertura richiesta (o NULL) */
+  void *aperta_arg;
+  cassa_fatto_t chiusa_fatto;  /* completamento della chiusura richiesta (o NULL) */
+  void *chiusa_arg;
+  ilist_t *clienti; /* clienti in coda alla cassa (escluso quello in servizio) */
+  atomic_int prodotti_in_coda; /* prodotti dei clienti in coda, leggibile senza lock */
   /* statistics */
   int clienti_serviti;  /* numero di clienti serviti */
   int numero_chiusure;  /* numero di chisusure della cassa */
@@ -30,9 +48,13 @@ int cassa_id(const cassiere_t *cassiere);
 int is_cassa_active(cassiere_t *cassiere);
 int is_cassa_closing(cassiere_t *cassiere);
 void init_cassiere(cassiere_t *cassiere, int tp, int s);
-int open_cassa(cassiere_t *cassiere);
-int close_cassa(cassiere_t *cassiere);
+int open_cassa(cassiere_t *cassiere, cassa_fatto_t fatto, void *arg);
+int close_cassa(cassiere_t *cassiere, cassa_fatto_t fatto, void *arg);
 void wait_cassa(cassiere_t *cassiere);
+void terminate_cassa(cassiere_t *cassiere);
 void add_cliente(cassiere_t *cassiere, cliente_t *cliente);
+int remove_cliente(cassiere_t *cassiere, cliente_t *cliente);
+void log_cassiere(const cassiere_t *cassiere);
+int lavoro_atteso(cassiere_t *cassiere);
 
 #endif
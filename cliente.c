@@ -1,7 +1,6 @@
 #include "cliente.h"
 #include "supermercato.h"
 #include "defines.h"
-#include "utils.h" /* safe_seed() */
 #include "logger.h"
 #include "stopwatch.h"
 #include "direttore.h" /* get_permesso() */
@@ -11,31 +10,50 @@
 #include <assert.h>
 
 /*
- * Thread di lavoro dei clienti.
+ * Scrive sul file di log le statistiche del cliente, che esce dal
+ * supermercato dopo aver acquistato 'prodotti' prodotti.
  */
-void* cliente_worker(void* arg) {
-  assert(arg != NULL);
-  cliente_t* cliente = (cliente_t*) arg;
+static void log_uscita(cliente_t *cliente, int prodotti) {
+  log_write("CLIENTE %d: prodotti acquistati = %d\n", cliente->id, prodotti);
+  log_write("CLIENTE %d: tempo totale = %.3f\n", cliente->id, (double)stopwatch_end(&cliente->total_time)/1000);
+  log_write("CLIENTE %d: tempo in coda = %.3f\n", cliente->id, (double)stopwatch_end(&cliente->queue_time)/1000);
+  log_write("CLIENTE %d: cambi di coda = %d \n", cliente->id, cliente->queue_changes);
+}
 
-  /* 
-   * Ottiene un intero incrementale in maniera thread-safe da usare per la
-   * generazione di numeri casuali.
-   */
-  unsigned int queue_changes = 0;
-  unsigned int seed = safe_seed();
+/*
+ * Accoda il cliente a una cassa aperta (vedi place_cliente()); 'cambio' != 0
+ * indica che la cassa precedente del cliente è stata chiusa.
+ * Le statistiche sono aggiornate prima dell'accodamento: da quel momento il
+ * cliente può essere spostato in un'altra coda (jockeying), servito ed
+ * eventualmente risvegliato da un altro thread.
+ * Restituisce: la cassa scelta, NULL se non ci sono casse aperte.
+ */
+static cassiere_t *accoda_cliente(cliente_t *cliente, int cambio) {
+  if (cambio) {
+    ++cliente->queue_changes;
+  }
+  else {
+    /* comincia a misurare il tempo trascorso in coda */
+    stopwatch_start(&cliente->queue_time);
+  }
 
-  /* Creazione record timespec e conversione dwell_time in nanosecondi */
-  struct timespec ts;
-  ts.tv_sec = cliente->dwell_time / 1000; // secondi
-  ts.tv_nsec = (cliente->dwell_time % 1000)*1000*1000; // nanosecondi
+  cassiere_t *cassa = place_cliente(cliente, cliente->supermercato, &cliente->rng);
+  if (cassa == NULL && cambio) {
+    --cliente->queue_changes; /* il cliente non ha cambiato coda */
+  }
+  return cassa;
+}
 
-  /* Cronometri utilizzati per misurare il tempo impiegato dal cliente nel
-   * supermercato e in coda */
-  stopwatch_t *total_time = stopwatch_create(STOPWATCH_STARTING);
-  stopwatch_t *queue_time = stopwatch_create(STOPWATCH_STOPPED);
+/*
+ * Job dei clienti, da sottomettere dopo dwell_time millisecondi dall'ingresso
+ * del cliente nel supermercato.
+ * Restituisce: 0 se il cliente è uscito dal supermercato dopo essere stato
+ * servito o senza acquisti, 1 se è uscito per mancanza di casse aperte.
+ */
+void* cliente_worker(void* arg) {
+  assert(arg != NULL);
+  cliente_t* cliente = (cliente_t*) arg;
 
-  /* Cliente impiega dwell_time millisecondi scegliendo i prodotti */
-  nanosleep(&ts, &ts);
   log_write("CLIENTE %d: terminato di scegliere gli acquisti dopo %.3f s \n", 
       cliente->id, (double)cliente->dwell_time/1000);
 
@@ -44,74 +62,141 @@ void* cliente_worker(void* arg) {
    */
   if (cliente->products == 0) {
     get_permesso();
-    log_write("CLIENTE %d: prodotti acquistati = 0\n", cliente->id);
-    log_write("CLIENTE %d: tempo totale = %.3f\n", cliente->id, (double)stopwatch_end(total_time)/1000);
-    log_write("CLIENTE %d: tempo in coda = 0.000\n", cliente->id);
-    log_write("CLIENTE %d: cambi di coda = 0\n", cliente->id);
-    stopwatch_free(total_time);
-    stopwatch_free(queue_time);
+    log_uscita(cliente, 0);
     return 0;
   }
 
   /* Thread loop: 
-   * attende finchè il cliente non viene servito,
-   * la cassa è stata chiusa, oppure il supermercato sta chiudendo.
+   * attende finchè il cliente non viene servito oppure la cassa in cui è in
+   * coda viene chiusa (anche alla chiusura del supermercato): in tal caso il
+   * cliente cerca un'altra cassa aperta e vi si accoda.
+   * Nota: l'evento di notifica è reimpostato prima di accodarsi di nuovo,
+   * quindi una notifica della nuova cassa non viene persa.
    */
-  cassiere_t *cassa;
-
-  pthread_mutex_lock_safe(&cliente->mtx);
-  while(!cliente->servito) {
-
-    /* Se il cliente non è accodato ad alcuna cassa o se la cassa a in cui è in
-     * coda è stata chiusa, cerca una cassa aperta e vi si accoda
-     * Nota: la cassa è chiusa solo dopo che il cliente corrente è stato
-     * servito, cioè la cassa non è più attiva e non è più in chiusura.
-     * Nota: per chiarezza la condizione di chiusura e di non nullità è divisa
-     * in due branch if-else, al fine di favorire la leggibilità.
-     */
-    if (cliente->cassiere == NULL) {
-      cassa = place_cliente(cliente, cliente->supermercato, &seed);
-
-      /* comincia a misurare il tempo trascorso in coda*/
-      if (cassa != NULL) {
-        stopwatch_start(queue_time); 
-      }
-    }
-    else if (!is_cassa_active(cliente->cassiere) 
-        && !is_cassa_closing(cliente->cassiere)) {
-      cassa = place_cliente(cliente, cliente->supermercato, &seed);
-      if (cassa != NULL) {
-        ++queue_changes;
-      }
+  cassiere_t *cassa = accoda_cliente(cliente, 0);
+  while (cassa != NULL) {
+    /* punto di attesa: sospende la coroutine o il thread del cliente */
+    oneshot_wait(&cliente->notifica);
+    oneshot_reset(&cliente->notifica);
+    if (cliente->servito) {
+      break;
     }
+    cassa = accoda_cliente(cliente, 1);
+  }
 
-    if (cassa == NULL) { /* non ci sono casse aperte nel supermercato */
-      assert(cliente->supermercato->num_casse == 0);
-      assert(!cliente->servito);
-      assert(cliente->cassiere == NULL || !is_cassa_closing(cliente->cassiere));
-      pthread_mutex_unlock_safe(&cliente->mtx);
-      log_write("CLIENTE %d: terminato per mancanza di casse aperte\n", cliente->id);
-      log_write("CLIENTE %d: prodotti acquistati = 0\n", cliente->id);
-      log_write("CLIENTE %d: tempo totale = %.3f\n", cliente->id, (double)stopwatch_end(total_time)/1000);
-      log_write("CLIENTE %d: tempo in coda = %.3f\n", cliente->id, (double)stopwatch_end(queue_time)/1000);
-      log_write("CLIENTE %d: cambi di coda = %d \n", cliente->id, queue_changes);
-      stopwatch_free(total_time);
-      stopwatch_free(queue_time);
-      return (void*) 1; /* cliente non servito */
-    }
-    pthread_cond_wait(&cliente->servito_cond, &cliente->mtx);
+  if (cassa == NULL) { /* non ci sono casse aperte nel supermercato */
+    assert(!cliente->servito);
+    log_write("CLIENTE %d: terminato per mancanza di casse aperte\n", cliente->id);
+    log_uscita(cliente, 0);
+    return (void*) 1; /* cliente non servito */
   }
 
-  pthread_mutex_unlock_safe(&cliente->mtx);
-  log_write("CLIENTE %d: prodotti acquistati = %d\n", cliente->id, cliente->products);
-  log_write("CLIENTE %d: tempo totale = %.3f\n", cliente->id, (double)stopwatch_end(total_time)/1000);
-  log_write("CLIENTE %d: tempo in coda = %.3f\n", cliente->id, (double)stopwatch_end(queue_time)/1000);
-  log_write("CLIENTE %d: cambi di coda = %d \n", cliente->id, queue_changes);
-  stopwatch_free(total_time);
-  stopwatch_free(queue_time);
+  log_uscita(cliente, cliente->products);
   return (void*) 0;
 }
 
+/*
+ * Corpo dei clienti eseguiti come coroutine (vedi coroutine_start()): il
+ * cliente sceglie i prodotti sospendendosi per dwell_time millisecondi, poi
+ * procede come cliente_worker(), i cui punti di attesa sospendono la
+ * coroutine anzichè il thread che la esegue.
+ */
+void *cliente_coroutine(void *arg) {
+  assert(arg != NULL);
+  cliente_t *cliente = (cliente_t*) arg;
+  coroutine_sleep(stopwatch_real_ms(cliente->dwell_time));
+  return cliente_worker(arg);
+}
+
+/*
+ * Fa uscire dal supermercato un cliente guidato dagli eventi, che ha
+ * acquistato 'prodotti' prodotti, e ne comunica l'esito alla routine
+ * cliente->uscita. Il cliente non è più acceduto dopo la chiamata.
+ */
+static void *esci_cliente(cliente_t *cliente, int prodotti, void *esito) {
+  log_uscita(cliente, prodotti);
+  cliente->stato = CLIENTE_USCITO;
+  cliente->uscita(cliente, esito, cliente->uscita_arg);
+  return esito;
+}
+
+/*
+ * Job di avanzamento di un cliente guidato dagli eventi: ogni esecuzione
+ * gestisce un evento senza mai attendere e restituisce il controllo.
+ * - CLIENTE_ACQUISTI: il cliente ha scelto i prodotti (dopo dwell_time
+ *   millisecondi) ed esce oppure si accoda a una cassa;
+ * - CLIENTE_IN_CODA: il cliente è stato servito ed esce, oppure la sua cassa
+ *   è stata chiusa e si accoda a un'altra cassa.
+ * Gli eventi di un cliente in coda sono generati dal cassiere tramite
+ * set_servito() e notifica_cliente(), che sottomettono nuovamente il job.
+ * All'uscita dal supermercato è chiamata la routine cliente->uscita.
+ */
+void *cliente_step(void *arg) {
+  assert(arg != NULL);
+  cliente_t *cliente = (cliente_t*) arg;
+  cassiere_t *cassa = NULL;
+
+  /* Un cassiere può sottomettere nuovamente il job appena il cliente è stato
+   * accodato, anche prima che questa esecuzione termini: lo stato è quindi
+   * aggiornato prima dell'accodamento e il cliente non è più acceduto dopo
+   * (vedi threadpool_job_run()). */
+  switch (cliente->stato) {
+    case CLIENTE_ACQUISTI:
+      log_write("CLIENTE %d: terminato di scegliere gli acquisti dopo %.3f s \n", 
+          cliente->id, (double)cliente->dwell_time/1000);
+      if (cliente->products == 0) {
+        get_permesso();
+        return esci_cliente(cliente, 0, (void*)0);
+      }
+      cliente->stato = CLIENTE_IN_CODA;
+      cassa = accoda_cliente(cliente, 0);
+      break;
+
+    case CLIENTE_IN_CODA:
+      if (cliente->servito) {
+        return esci_cliente(cliente, cliente->products, (void*)0);
+      }
+      /* la cassa è stata chiusa e ha rimosso il cliente dalla coda */
+      assert(cliente->link.list == NULL);
+      cassa = accoda_cliente(cliente, 1);
+      break;
+
+    default:
+      assert(0);
+  }
+
+  if (cassa == NULL) { /* non ci sono casse aperte nel supermercato */
+    log_write("CLIENTE %d: terminato per mancanza di casse aperte\n", cliente->id);
+    return esci_cliente(cliente, 0, (void*)1);
+  }
+  return (void*)0;
+}
+
+/*
+ * Fa entrare nel supermercato un cliente inizializzato con init_cliente(),
+ * guidato dagli eventi eseguiti dalla pool 'eventi': il cliente non occupa
+ * alcun thread mentre sceglie i prodotti o attende in coda.
+ * All'uscita del cliente è chiamata la routine 'uscita' con l'esito del
+ * cliente (vedi cliente_worker()) e l'argomento 'arg', a cui è affidata la
+ * distruzione del cliente.
+ * La pool non deve limitare il numero di job in attesa, perchè i cassieri
+ * sottomettono gli eventi dei clienti senza poter attendere.
+ */
+void start_cliente_eventi(
+    cliente_t *cliente,
+    threadpool_t *eventi,
+    void (*uscita)(cliente_t *cliente, void *esito, void *arg),
+    void *arg) {
+  assert(cliente != NULL && eventi != NULL && uscita != NULL);
+  assert(eventi->max_jobs == 0);
+  cliente->stato = CLIENTE_ACQUISTI;
+  cliente->eventi = eventi;
+  cliente->uscita = uscita;
+  cliente->uscita_arg = arg;
+  threadpool_job_init(&cliente->job, cliente_step, (void*)cliente, NULL);
+  threadpool_add_delayed(eventi, &cliente->job, stopwatch_real_ms(cliente->dwell_time));
+}
+
 /*
  * Alloca un cliente.
  * - dwell_time indica il tempo (in millisecondi) che impiega il cliente per 
@@ -121,27 +206,56 @@ void* cliente_worker(void* arg) {
  * Restituisce: un puntatore al cliente creato.
  */
 cliente_t *create_cliente(int dwell_time, int products, supermercato_t *supermercato) {
-  static int cliente_id = 0;
-  assert(supermercato != NULL);
-  assert(dwell_time >= 0);
-  assert(products >= 0);
-
   cliente_t *cliente = (cliente_t *) malloc(sizeof(cliente_t));
   if (cliente == NULL) {
     handle_error("malloc create_cliente");
   }
 
+  init_cliente(cliente, dwell_time, products, supermercato);
+  return cliente;
+}
+
+/*
+ * Inizializza un cliente la cui memoria è gestita dal chiamante (vedi
+ * create_cliente()). Il cliente deve essere distrutto con destroy_cliente().
+ */
+void init_cliente(
+    cliente_t *cliente,
+    int dwell_time,
+    int products,
+    supermercato_t *supermercato) {
+  static int cliente_id = 0;
+  assert(cliente != NULL);
+  assert(supermercato != NULL);
+  assert(dwell_time >= 0);
+  assert(products >= 0);
+
   cliente->id = cliente_id++;
   cliente->dwell_time = dwell_time;
   cliente->products = products;
   cliente->servito = 0;
   cliente->supermercato = supermercato;
   cliente->cassiere = NULL;
+  ilist_node_init(&cliente->link);
+  /* il tempo nel supermercato è misurato a partire dall'ingresso */
+  stopwatch_init(&cliente->total_time, STOPWATCH_STARTING);
+  stopwatch_init(&cliente->queue_time, STOPWATCH_STOPPED);
+  cliente->queue_changes = 0;
+  /* flusso indipendente, determinato dall'id del cliente */
+  rng_init(&cliente->rng, RNG_CLIENTI, cliente->id);
+  cliente->stato = CLIENTE_ACQUISTI;
+  cliente->eventi = NULL;
+  cliente->uscita = NULL;
+  cliente->uscita_arg = NULL;
+  oneshot_init(&cliente->notifica);
+}
 
-  pthread_mutex_init_ec(&cliente->mtx, NULL);
-  pthread_cond_init(&cliente->servito_cond, NULL);
-
-  return cliente;
+/*
+ * Distrugge un cliente inizializzato con init_cliente(), senza deallocarne
+ * la memoria, che può essere riutilizzata per un nuovo cliente.
+ */
+void destroy_cliente(cliente_t *cliente) {
+  log_write("CLIENTE %d: Liberando memoria\n", cliente->id);
 }
 
 /*
@@ -149,14 +263,38 @@ cliente_t *create_cliente(int dwell_time, int products, supermercato_t *supermer
  * effettuato il join.
  */
 void free_cliente(cliente_t* cliente) {
-  log_write("CLIENTE %d: Liberando memoria\n", cliente->id);
+  destroy_cliente(cliente);
   free(cliente);
 }
 
+/*
+ * Risveglia il cliente: segnala l'evento di notifica, su cui attende il
+ * thread o la coroutine del cliente, oppure, se il cliente è guidato dagli
+ * eventi, sottomette il suo job alla pool degli eventi.
+ * Il cliente non è più acceduto dopo la chiamata.
+ */
+static void notifica(cliente_t *cliente) {
+  if (cliente->eventi != NULL) {
+    threadpool_add(cliente->eventi, &cliente->job);
+  }
+  else {
+    oneshot_set(&cliente->notifica);
+  }
+}
+
+/*
+ * Informa il cliente che è stato servito: il flag è scritto prima della
+ * notifica, che ne garantisce la visibilità al cliente risvegliato.
+ */
 void set_servito(cliente_t *cliente, int servito) {
-  pthread_mutex_lock_safe(&cliente->mtx);
   cliente->servito = servito;
-  pthread_cond_signal(&cliente->servito_cond);
-  pthread_mutex_unlock_safe(&cliente->mtx);
+  notifica(cliente);
 }
 
+/*
+ * Informa un cliente in coda che la cassa è stata chiusa, risvegliandolo
+ * senza impostare il flag servito: il cliente cercherà un'altra cassa.
+ */
+void notifica_cliente(cliente_t *cliente) {
+  notifica(cliente);
+}
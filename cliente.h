@@ -2,29 +2,70 @@
 #define _CLIENTE_H
 
 #include <pthread.h>
+#include "ilist.h"
+#include "stopwatch.h"
+#include "threadpool.h"
+#include "coroutine.h"
+#include "oneshot.h"
+#include "rng.h"
 
 struct supermercato;
 struct cassiere;
 
+/*
+ * Stati di un cliente guidato dagli eventi (vedi cliente_step()):
+ * il cliente sceglie i prodotti, attende in coda a una cassa (eventualmente
+ * cambiando cassa quando questa chiude) ed esce dal supermercato.
+ */
+enum { CLIENTE_ACQUISTI, CLIENTE_IN_CODA, CLIENTE_USCITO };
+
 typedef struct cliente {
   int id;         /* id univoco associato al cliente */
   int dwell_time; /* tempo impiegato per scegliere i prodotti */
   int products;   /* numero di prodotti comprati */
-  int servito;    /* 1 se servito, 0 altrimenti */
+  int servito;    /* 1 se servito, 0 altrimenti (scritto prima di 'notifica') */
   struct cassiere *cassiere;   /* cassa in cui il cliente è in coda */
   struct supermercato *supermercato; /* riferimento al supermercato */
-  pthread_mutex_t mtx;
-  pthread_cond_t servito_cond;
+  ilist_node_t link; /* collegamento nella coda della cassa */
+  /* risveglio del cliente in coda: servito o cassa chiusa (vedi set_servito()
+   * e notifica_cliente()); non utilizzato dai clienti guidati dagli eventi */
+  oneshot_t notifica;
+  /* statistiche */
+  stopwatch_t total_time;   /* tempo trascorso nel supermercato */
+  stopwatch_t queue_time;   /* tempo trascorso in coda */
+  unsigned int queue_changes; /* cambi di coda */
+  rng_t rng;                /* generatore per la scelta delle casse */
+  /* job del cliente (cliente_worker() o cliente_step()) */
+  threadpool_job_t job;
+  /* motore a eventi (vedi start_cliente_eventi()) */
+  int stato;                /* CLIENTE_ACQUISTI, CLIENTE_IN_CODA o CLIENTE_USCITO */
+  threadpool_t *eventi;     /* pool che esegue gli eventi (NULL: cliente_worker()) */
+  void (*uscita)(struct cliente *cliente, void *esito, void *arg);
+  void *uscita_arg;
 }cliente_t;
 
 cliente_t* create_cliente(
     int dwell_time,
-    int products, 
+    int products,
     struct supermercato *supermercato);
 
+void init_cliente(
+    cliente_t *cliente,
+    int dwell_time,
+    int products,
+    struct supermercato *supermercato);
+
+void destroy_cliente(cliente_t *cliente);
 void free_cliente(cliente_t *cliente);
 void *cliente_worker(void *arg);
+void *cliente_step(void *arg);
+void *cliente_coroutine(void *arg);
+void start_cliente_eventi(
+    cliente_t *cliente,
+    threadpool_t *eventi,
+    void (*uscita)(cliente_t *cliente, void *esito, void *arg),
+    void *arg);
 void set_servito(cliente_t *cliente, int servito);
+void notifica_cliente(cliente_t *cliente);
 
 #endif
-
@@ -0,0 +1,322 @@
+#include "coroutine.h"
+#include "defines.h"
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>   /* sysconf() */
+#include <sys/mman.h> /* mmap(), mprotect() */
+#include <sched.h> /* sched_yield() */
+#include <assert.h>
+
+/* Coroutine in esecuzione sul thread corrente (NULL se nessuna) */
+static __thread coroutine_t *corrente = NULL;
+
+/*
+ * Restituisce la coroutine in esecuzione, NULL se il chiamante non è una
+ * coroutine.
+ * Nota: una coroutine può essere ripresa da un thread diverso da quello che
+ * l'ha sospesa, quindi l'indirizzo della variabile thread-local non deve
+ * essere riutilizzato dal compilatore dopo una sospensione: l'accesso avviene
+ * sempre tramite questa funzione, che non può essere espansa inline.
+ */
+__attribute__((noinline)) coroutine_t *coroutine_self(void) {
+  return corrente;
+}
+
+__attribute__((noinline)) static void set_corrente(coroutine_t *co) {
+  corrente = co;
+}
+
+/*
+ * Anche errno è thread-local e __errno_location() è dichiarata const, quindi
+ * il suo indirizzo può essere riutilizzato dopo una sospensione: errno è
+ * letto e scritto soltanto tramite queste funzioni, che non possono essere
+ * espanse inline.
+ */
+__attribute__((noinline)) static int leggi_errno(void) {
+  return errno;
+}
+
+__attribute__((noinline)) static void scrivi_errno(int valore) {
+  errno = valore;
+}
+
+/*
+ * Alloca uno stack, riutilizzando quelli delle coroutine terminate.
+ * Ogni stack è una mappatura anonima preceduta (all'estremo inferiore, verso
+ * cui lo stack cresce) da una pagina di guardia inaccessibile: un overflow
+ * termina il processo con SIGSEGV anzichè sovrascrivere altra memoria.
+ * Restituisce l'indirizzo iniziale della parte utilizzabile.
+ */
+static void *stack_alloc(coroutine_sched_t *sched) {
+  pthread_mutex_lock_safe(&sched->mtx);
+  void **stack = sched->stacks;
+  if (stack != NULL) {
+    sched->stacks = (void**) *stack;
+  }
+  sched->active++;
+  pthread_mutex_unlock_safe(&sched->mtx);
+
+  if (stack == NULL) {
+    char *base = (char*) mmap(NULL, sched->guard_size + sched->stack_size,
+        PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    if (base == MAP_FAILED) {
+      handle_error("coroutine stack mmap");
+    }
+    if (mprotect(base, sched->guard_size, PROT_NONE) == -1) {
+      handle_error("coroutine stack mprotect");
+    }
+    stack = (void**)(base + sched->guard_size);
+  }
+  return stack;
+}
+
+static void stack_free(coroutine_sched_t *sched, void *stack) {
+  char *base = (char*)stack - sched->guard_size;
+  if (munmap(base, sched->guard_size + sched->stack_size) == -1) {
+    handle_error("coroutine stack munmap");
+  }
+}
+
+static void stack_release(coroutine_sched_t *sched, void *stack) {
+  pthread_mutex_lock_safe(&sched->mtx);
+  *(void**)stack = sched->stacks;
+  sched->stacks = (void**) stack;
+  sched->active--;
+  pthread_mutex_unlock_safe(&sched->mtx);
+}
+
+/*
+ * Punto di ingresso delle coroutine: al termine della funzione la coroutine
+ * restituisce il controllo al thread che la sta eseguendo, senza tornare.
+ */
+static void avvio(void) {
+  coroutine_t *co = coroutine_self();
+  co->result = co->f(co->arg);
+  co->terminata = 1;
+  setcontext(&co->ritorno);
+}
+
+/*
+ * Job di ripresa di una coroutine: esegue la coroutine fino alla successiva
+ * sospensione o al suo termine.
+ * Le azioni che possono far riprendere la coroutine (co->dopo) sono eseguite
+ * soltanto dopo che la coroutine ha restituito il controllo, perchè un'altra
+ * coroutine o un altro thread potrebbe riprenderla immediatamente: il job non
+ * accede più alla coroutine dopo tali azioni.
+ */
+static void *riprendi(void *arg) {
+  coroutine_t *co = (coroutine_t*) arg;
+  set_corrente(co);
+  if (swapcontext(&co->ritorno, &co->ctx) == -1) {
+    handle_error("coroutine swapcontext");
+  }
+  set_corrente(NULL);
+
+  if (co->terminata) {
+    /* lo stack è riutilizzabile prima che la memoria della coroutine sia
+     * restituita al chiamante */
+    stack_release(co->sched, co->stack);
+    co->fine(co, co->result, co->fine_arg);
+    return (void*)0;
+  }
+
+  assert(co->dopo != NULL);
+  co->dopo(co, co->dopo_arg);
+  return (void*)0;
+}
+
+/*
+ * Sospende la coroutine corrente: dopo la sospensione il thread che la
+ * eseguiva chiama dopo(co, arg), che deve garantirne la ripresa futura.
+ * Alla ripresa, eventualmente su un altro thread, errno ha il valore che
+ * aveva prima della sospensione.
+ */
+static void sospendi(void (*dopo)(coroutine_t*, void*), void *arg) {
+  coroutine_t *co = coroutine_self();
+  assert(co != NULL);
+  co->dopo = dopo;
+  co->dopo_arg = arg;
+  /* errno segue la coroutine sul thread che la riprende */
+  int errno_salvato = leggi_errno();
+  if (swapcontext(&co->ctx, &co->ritorno) == -1) {
+    handle_error("coroutine swapcontext");
+  }
+  assert(coroutine_self() == co);
+  scrivi_errno(errno_salvato);
+}
+
+static void dopo_yield(coroutine_t *co, void *arg) {
+  (void) arg;
+  threadpool_add(co->sched->tpool, &co->job);
+}
+
+static void dopo_sleep(coroutine_t *co, void *arg) {
+  (void) arg;
+  threadpool_add_delayed(co->sched->tpool, &co->job, co->dopo_ms);
+}
+
+static void dopo_wait(coroutine_t *co, void *arg) {
+  (void) co;
+  pthread_mutex_unlock_safe((pthread_mutex_t*) arg);
+}
+
+/*
+ * Crea uno scheduler le cui coroutine sono eseguite da 'threads' thread e
+ * hanno uno stack di 'stack_size' byte, arrotondati a un multiplo della
+ * dimensione di pagina.
+ */
+coroutine_sched_t *coroutine_sched_create(size_t threads, size_t stack_size) {
+  assert(threads > 0 && stack_size >= sizeof(void*));
+  long pagina = sysconf(_SC_PAGESIZE);
+  if (pagina == -1) {
+    handle_error("coroutine_sched_create sysconf");
+  }
+  coroutine_sched_t *sched = (coroutine_sched_t*) malloc(sizeof(coroutine_sched_t));
+  if (sched == NULL) {
+    handle_error("coroutine_sched_create malloc");
+  }
+
+  /* il numero di coroutine pronte non è limitato: le coroutine sono riprese
+   * anche da thread che non possono attendere (vedi coroutine_signal()) */
+  threadpool_attr_t attr;
+  threadpool_attr_init(&attr, threads);
+  attr.work_stealing = 1;
+  sched->tpool = threadpool_create_attr(&attr);
+  /* gli stack sono mappati a pagine intere */
+  sched->guard_size = (size_t)pagina;
+  sched->stack_size = (stack_size + sched->guard_size - 1) / sched->guard_size * sched->guard_size;
+  sched->stacks = NULL;
+  sched->active = 0;
+  pthread_mutex_init_ec(&sched->mtx, NULL);
+  return sched;
+}
+
+/*
+ * Termina i thread dello scheduler e libera gli stack delle coroutine.
+ * Tutte le coroutine avviate devono essere già terminate.
+ */
+void coroutine_sched_free(coroutine_sched_t *sched) {
+  assert(sched != NULL);
+  threadpool_free(sched->tpool);
+  assert(sched->active == 0);
+  while (sched->stacks != NULL) {
+    void **stack = sched->stacks;
+    sched->stacks = (void**) *stack;
+    stack_free(sched, stack);
+  }
+  pthread_mutex_destroy(&sched->mtx);
+  free(sched);
+}
+
+/*
+ * Avvia la coroutine 'co', allocata dal chiamante, che esegue f(arg).
+ * Al termine di f è chiamata fine(co, risultato, fine_arg) da un thread dello
+ * scheduler: da quel momento la memoria di 'co' può essere riutilizzata.
+ */
+void coroutine_start(
+    coroutine_sched_t *sched,
+    coroutine_t *co,
+    void *(*f)(void*),
+    void *arg,
+    void (*fine)(coroutine_t *co, void *result, void *arg),
+    void *fine_arg) {
+  assert(sched != NULL && co != NULL && f != NULL && fine != NULL);
+  co->sched = sched;
+  co->f = f;
+  co->arg = arg;
+  co->result = NULL;
+  co->terminata = 0;
+  co->dopo = NULL;
+  co->fine = fine;
+  co->fine_arg = fine_arg;
+  co->stack = stack_alloc(sched);
+
+  if (getcontext(&co->ctx) == -1) {
+    handle_error("coroutine getcontext");
+  }
+  co->ctx.uc_stack.ss_sp = co->stack;
+  co->ctx.uc_stack.ss_size = sched->stack_size;
+  co->ctx.uc_link = NULL;
+  makecontext(&co->ctx, avvio, 0);
+
+  threadpool_job_init(&co->job, riprendi, (void*)co, NULL);
+  threadpool_add(sched->tpool, &co->job);
+}
+
+/*
+ * Sospende la coroutine corrente; dopo la sospensione il thread che la
+ * eseguiva chiama dopo(co, arg), che deve registrare la coroutine in modo che
+ * sia ripresa con coroutine_unpark(). Consente di costruire primitive di
+ * attesa senza mutex (vedi oneshot_wait()).
+ */
+void coroutine_park(void (*dopo)(coroutine_t *co, void *arg), void *arg) {
+  assert(dopo != NULL);
+  sospendi(dopo, arg);
+}
+
+/*
+ * Riprende la coroutine 'co' sospesa da coroutine_park(). Non è mai bloccante.
+ */
+void coroutine_unpark(coroutine_t *co) {
+  assert(co != NULL);
+  threadpool_add(co->sched->tpool, &co->job);
+}
+
+/*
+ * Cede il thread alle altre coroutine pronte.
+ */
+void coroutine_yield(void) {
+  if (coroutine_self() == NULL) {
+    sched_yield();
+    return;
+  }
+  sospendi(dopo_yield, NULL);
+}
+
+/*
+ * Sospende la coroutine corrente per 'ms' millisecondi, oppure il thread
+ * chiamante se non è una coroutine.
+ */
+void coroutine_sleep(int ms) {
+  coroutine_t *co = coroutine_self();
+  if (co == NULL) {
+    struct timespec ts = { ms / 1000, (ms % 1000)*1000*1000 };
+    while (nanosleep(&ts, &ts) == -1);
+    return;
+  }
+  co->dopo_ms = ms;
+  sospendi(dopo_sleep, NULL);
+}
+
+/*
+ * Equivalente di pthread_cond_wait() per la coroutine corrente, che deve
+ * essere chiamata con 'mtx' acquisito: la coroutine è registrata in *attesa,
+ * rilascia il mutex dopo essersi sospesa e lo riacquisisce alla ripresa,
+ * causata da coroutine_signal(attesa). Come per pthread_cond_wait() la
+ * condizione attesa deve essere ricontrollata dopo il risveglio.
+ */
+void coroutine_wait(coroutine_t **attesa, pthread_mutex_t *mtx) {
+  assert(attesa != NULL && *attesa == NULL && mtx != NULL);
+  coroutine_t *co = coroutine_self();
+  assert(co != NULL);
+  *attesa = co;
+  sospendi(dopo_wait, (void*)mtx);
+  pthread_mutex_lock_safe(mtx);
+}
+
+/*
+ * Riprende la coroutine registrata in *attesa da coroutine_wait(), se presente.
+ * Deve essere chiamata con il mutex passato a coroutine_wait() acquisito; non
+ * è mai bloccante.
+ * Restituisce: 1 se una coroutine è stata ripresa, 0 altrimenti.
+ */
+int coroutine_signal(coroutine_t **attesa) {
+  assert(attesa != NULL);
+  coroutine_t *co = *attesa;
+  if (co == NULL) {
+    return 0;
+  }
+  *attesa = NULL;
+  threadpool_add(co->sched->tpool, &co->job);
+  return 1;
+}
@@ -0,0 +1,74 @@
+#ifndef COROUTINE_H
+#define COROUTINE_H
+#include <stdlib.h> /* size_t */
+#include <pthread.h>
+#include <ucontext.h>
+#include "threadpool.h"
+
+/*
+ * Coroutine (green thread) eseguite da un numero ridotto di thread (M:N).
+ * Ogni coroutine ha un proprio stack, di dimensione ridotta e riutilizzato
+ * dalle coroutine successive, e può sospendersi nei punti di attesa
+ * (coroutine_sleep(), coroutine_wait(), coroutine_yield()) senza occupare il
+ * thread che la esegue.
+ * Le coroutine pronte sono job della threadpool dello scheduler, che le
+ * riprende su un thread qualsiasi: una coroutine non deve quindi mantenere
+ * mutex acquisiti nè riferimenti a variabili thread-local durante una
+ * sospensione. Questo vale anche per errno: il suo valore è conservato dalla
+ * sospensione, ma il compilatore può riutilizzarne l'indirizzo calcolato prima
+ * della sospensione, quindi una funzione non deve accedere a errno sia prima
+ * sia dopo un punto di sospensione (coroutine_self() è invece sempre sicura).
+ * Lo stack di ogni coroutine è preceduto da una pagina di guardia: un
+ * overflow termina il processo con SIGSEGV.
+ * Le funzioni di sospensione chiamate al di fuori di una coroutine attendono
+ * bloccando il thread chiamante.
+ */
+
+struct coroutine;
+
+typedef struct coroutine_sched {
+  threadpool_t *tpool;  /* thread che eseguono le coroutine pronte */
+  size_t stack_size;    /* dimensione dello stack delle coroutine (multiplo della pagina) */
+  size_t guard_size;    /* pagina di guardia sotto ogni stack */
+  void **stacks;        /* stack liberi (lista collegata tramite la prima parola) */
+  size_t active;        /* coroutine avviate e non ancora terminate */
+  pthread_mutex_t mtx;  /* sincronizza stacks e active */
+}coroutine_sched_t;
+
+typedef struct coroutine {
+  ucontext_t ctx;              /* contesto della coroutine */
+  ucontext_t ritorno;          /* contesto del thread che la sta eseguendo */
+  void *stack;
+  coroutine_sched_t *sched;
+  threadpool_job_t job;        /* ripresa della coroutine */
+  void *(*f)(void*);
+  void *arg;
+  void *result;
+  int terminata;
+  /* azione eseguita dal thread dopo la sospensione della coroutine */
+  void (*dopo)(struct coroutine *co, void *arg);
+  void *dopo_arg;
+  int dopo_ms;                 /* attesa di coroutine_sleep() */
+  /* routine chiamata al termine della coroutine */
+  void (*fine)(struct coroutine *co, void *result, void *arg);
+  void *fine_arg;
+}coroutine_t;
+
+coroutine_sched_t *coroutine_sched_create(size_t threads, size_t stack_size);
+void coroutine_sched_free(coroutine_sched_t *sched);
+void coroutine_start(
+    coroutine_sched_t *sched,
+    coroutine_t *co,
+    void *(*f)(void*),
+    void *arg,
+    void (*fine)(coroutine_t *co, void *result, void *arg),
+    void *fine_arg);
+coroutine_t *coroutine_self(void);
+void coroutine_yield(void);
+void coroutine_sleep(int ms);
+void coroutine_wait(coroutine_t **attesa, pthread_mutex_t *mtx);
+int coroutine_signal(coroutine_t **attesa);
+void coroutine_park(void (*dopo)(coroutine_t *co, void *arg), void *arg);
+void coroutine_unpark(coroutine_t *co);
+
+#endif
@@ -6,57 +6,79 @@
 #include <assert.h>
 #include <unistd.h>
 
-#define PATIENCE 25
-
 static supermercato_t *s;
 static pthread_t thread_id;
-static int *in_coda = NULL; /* numero clienti in coda, indicizzato dall'id dei cassieri */
-static pthread_mutex_t mtx; /* mutex di sincronizzazione per l'array in_coda */
+static stato_code_t code; /* ultime comunicazioni dei cassieri (senza lock) */
+/* mutex di sincronizzazione per le richieste in corso e la terminazione: non
+ * è acquisito dalle comunicazioni dei cassieri, salvo per risvegliare il
+ * direttore */
+static pthread_mutex_t mtx;
 
 static pthread_cond_t open_close_cassa_cond = PTHREAD_COND_INITIALIZER;
-static int d_s1, d_s2;
+static int d_s1;
 static int quit;
-static int count = 0; /* numero di comunicazioni ricevute da parte dei cassieri */
+static atomic_int count; /* numero di comunicazioni ricevute da parte dei cassieri */
+static atomic_int permessi; /* permessi di uscita concessi ai clienti */
+/* richieste di apertura e chiusura inviate e non ancora eseguite */
+static int aperture_in_corso = 0;
+static int chiusure_in_corso = 0;
 
 /*
- * Restituisce 1 se sono verificate le condizioni per aprire una nuova cassa.
- * La funzione utilizza variabili condivise tra più thread (in_coda), quindi
- * deve essere chiamata con un lock già ottenuto.
+ * Restituisce il numero di casse da aprire secondo gli aggregati 'a': una per
+ * ogni cassa con almeno s2 clienti in coda, escluse le aperture già richieste
+ * e non ancora eseguite.
+ * Deve essere chiamata con il lock del direttore già ottenuto.
  */
-static int should_open_cassa(void) {
-  assert(in_coda != NULL);
-  for (uint i=0; i<s->max_casse; i++) {
-    if (in_coda[i] >= d_s2) {
-      return 1; /* è necessario aprire una cassa */
-    }
-  }
+static int casse_da_aprire(aggregati_t a) {
+  int n = a.sovraccariche - aperture_in_corso;
+  return n > 0 ? n : 0;
+}
 
-  return 0; /* nessuna cassa da aprire */
+/*
+ * Restituisce 1 se, secondo gli aggregati 'a', sono verificate le condizioni
+ * per chiudere una cassa e nessuna chiusura è in corso.
+ * Deve essere chiamata con il lock del direttore già ottenuto.
+ */
+static int should_close_cassa(aggregati_t a) {
+  return chiusure_in_corso == 0 && a.scariche >= d_s1;
 }
 
 /*
- * Restituisce 1 se sono verificate le condizioni per chiudere una cassa.
- * La funzione utilizza variabili condivise tra più thread (in_coda), quindi
- * deve essere chiamata con un lock già ottenuto.
+ * Completamento di una richiesta di apertura, chiamata dal thread del
+ * cassiere (vedi open_cassa_supermercato()).
  */
-static int should_close_cassa(void) {
-  assert(in_coda != NULL);
-  int n = 0; /* numero di casse aperte con al più un cliente */
-  uint i;
-
-  for (i=0; i<s->max_casse && n < d_s1; i++) {
-    if (in_coda[i] <= 1) {
-      n++;
-    }
-  }
-  assert(n == d_s1 || i == s->max_casse);
-  return n >= d_s1;
+static void apertura_eseguita(cassiere_t *cassa, void *arg) {
+  (void) cassa;
+  (void) arg;
+  pthread_mutex_lock_safe(&mtx);
+  assert(aperture_in_corso > 0);
+  aperture_in_corso--;
+  /* le casse da aprire possono essere aumentate anche se gli aggregati non
+   * cambiano (ad esempio con una coda costantemente sovraccarica) */
+  pthread_cond_signal(&open_close_cassa_cond);
+  pthread_mutex_unlock_safe(&mtx);
+}
+
+/*
+ * Completamento di una richiesta di chiusura, chiamata dal thread del
+ * cassiere dopo la sua ultima comunicazione (vedi close_cassa_supermercato()):
+ * la coda della cassa chiusa è vuota.
+ */
+static void chiusura_eseguita(cassiere_t *cassa, void *arg) {
+  (void) arg;
+  stato_code_aggiorna(&code, cassa_id(cassa), 0);
+  pthread_mutex_lock_safe(&mtx);
+  assert(chiusure_in_corso > 0);
+  chiusure_in_corso--;
+  pthread_cond_signal(&open_close_cassa_cond);
+  pthread_mutex_unlock_safe(&mtx);
 }
 
 /*
  * Thread di lavoro del direttore
  */
 static void *working_thread(void *arg) {
+  (void) arg;
   cassiere_t *cassa;
   printf("DIRETTORE: Thread creato correttamente.\n");
 
@@ -68,10 +90,14 @@ static void *working_thread(void *arg) {
   while (!quit) {
 
     /* si mette in attesa che le condizioni per l'apertura/chiusura delle casse
-     * siano verificate
+     * siano verificate: gli aggregati sono letti in un'unica operazione,
+     * senza bloccare i cassieri
      */
-    while((!quit && count < PATIENCE) || (!should_open_cassa() && !should_close_cassa() && !quit)) {
+    aggregati_t a = stato_code_aggregati(&code);
+    while((!quit && atomic_load(&count) < PATIENCE)
+        || (!casse_da_aprire(a) && !should_close_cassa(a) && !quit)) {
       pthread_cond_wait(&open_close_cassa_cond, &mtx);
+      a = stato_code_aggregati(&code);
     }
 
     /* Ricevuto segnale di terminazione */
@@ -81,34 +107,46 @@ static void *working_thread(void *arg) {
       return (void*) 0;
     }
 
-    /* apre/chiude una cassa se sono verificate le condizioni e se sono state
-     * ricevute almeno 'PATIENCE' comunicazioni da parte dei cassieri
-     * dall'apertura del supermercato o dalla precedente apertura/chiusura
-     * di una cassa.
+    /* apre una cassa per ogni cassa sovraccarica oppure, se non ce ne sono,
+     * chiude una cassa, dopo aver ricevuto almeno 'PATIENCE' comunicazioni
+     * da parte dei cassieri dall'apertura del supermercato o dalla decisione
+     * precedente.
+     * Le richieste non sono bloccanti: il loro completamento è notificato
+     * da apertura_eseguita() e chiusura_eseguita(), quindi il direttore
+     * continua a ricevere le comunicazioni dei cassieri.
      */
-    if (should_open_cassa() && count >= PATIENCE) {
-      /* rilascia il lock perchè open_cassa_supermercato() è una funzione bloccante */
-      pthread_mutex_unlock_safe(&mtx); 
-      /* apri cassa */
-      cassa = open_cassa_supermercato(s);
-      if (cassa != NULL) {
-        printf("DIRETTORE: Aprendo cassa %d.\n", cassa_id(cassa));
+    int da_aprire = casse_da_aprire(a);
+    int chiudi = da_aprire == 0;
+    aperture_in_corso += da_aprire;
+    chiusure_in_corso += chiudi;
+    atomic_store(&count, 0);
+    pthread_mutex_unlock_safe(&mtx); 
+
+    for (int i=0; i<da_aprire; i++) {
+      cassa = open_cassa_supermercato(s, apertura_eseguita, NULL);
+      if (cassa == NULL) { /* nessuna cassa disponibile */
+        pthread_mutex_lock_safe(&mtx); 
+        aperture_in_corso -= da_aprire - i;
+        pthread_mutex_unlock_safe(&mtx); 
+        break;
       }
-      pthread_mutex_lock_safe(&mtx); 
-      count = 0;
+      printf("DIRETTORE: Aprendo cassa %d.\n", cassa_id(cassa));
     }
-    if (should_close_cassa() && count >= PATIENCE) {
-      /* rilascia il lock perchè close_cassa_supermercato() è una funzione bloccante */
-      pthread_mutex_unlock_safe(&mtx); 
-      /* chiudi cassa */
-      cassa = close_cassa_supermercato(s);
+    if (chiudi) {
+      cassa = close_cassa_supermercato(s, chiusura_eseguita, NULL);
       if (cassa != NULL) {
         printf("DIRETTORE: Chiudendo cassa %d.\n", cassa_id(cassa));
+        /* la cassa in chiusura non è più considerata nelle decisioni */
+        stato_code_aggiorna(&code, cassa_id(cassa), 0);
+      }
+      else {
+        pthread_mutex_lock_safe(&mtx); 
+        chiusure_in_corso--;
+        pthread_mutex_unlock_safe(&mtx); 
       }
-      pthread_mutex_lock_safe(&mtx); 
-      in_coda[cassa_id(cassa)] = 0;
-      count = 0;
     }
+
+    pthread_mutex_lock_safe(&mtx); 
   }
 
   pthread_mutex_unlock_safe(&mtx); 
@@ -131,16 +169,15 @@ void init_direttore(supermercato_t *supermercato, int s1, int s2) {
   assert(supermercato->max_casse > 0);
 
   s = supermercato;
-  in_coda = (int*) calloc(s->max_casse, sizeof(int));
-  if (in_coda == NULL) {
-    handle_error("init_direttore calloc");
-  }
+  stato_code_init(&code, s->max_casse, s2);
 
   pthread_mutex_init_ec(&mtx, NULL);
   d_s1 = s1;
-  d_s2 = s2;
   quit = 0;
-  count = 0;
+  atomic_init(&count, 0);
+  atomic_init(&permessi, 0);
+  aperture_in_corso = 0;
+  chiusure_in_corso = 0;
 
   int res = pthread_create(&thread_id, NULL, &working_thread, NULL);
   if (res != 0) {
@@ -157,19 +194,29 @@ void comunica_numero_clienti(const cassiere_t *cassiere, int n) {
   assert(cassiere != NULL);
   assert(cassa_id(cassiere) >= 0);
   assert(cassa_id(cassiere) < (int)s->max_casse);
-  assert(in_coda != NULL);
 
-  pthread_mutex_lock_safe(&mtx);
-
-  in_coda[cassa_id(cassiere)] = n;
-
-  assert(count >= 0);
-  count++;
-
-  /* Segnala al direttore gli attuali clienti in coda */
-  pthread_cond_signal(&open_close_cassa_cond);
+  /* la comunicazione non acquisisce lock */
+  int cambiati = stato_code_aggiorna(&code, cassa_id(cassiere), n);
+  int c = atomic_fetch_add(&count, 1) + 1;
+  assert(c > 0);
 
-  pthread_mutex_unlock_safe(&mtx);
+  /*
+   * Risveglio coalescente: la decisione del direttore dipende dal numero di
+   * comunicazioni, dagli aggregati e dalle richieste in corso. Le
+   * comunicazioni risvegliano il direttore soltanto quando raggiungono
+   * PATIENCE oppure, successivamente, quando modificano gli aggregati; le
+   * variazioni delle richieste in corso sono segnalate da
+   * apertura_eseguita() e chiusura_eseguita(). Negli altri casi il mutex non
+   * è acquisito. Il segnale è inviato con il mutex acquisito dopo
+   * l'aggiornamento, e il direttore valuta le condizioni con il mutex
+   * acquisito prima di attendere: un risveglio necessario non può essere
+   * perso.
+   */
+  if (c == PATIENCE || (c > PATIENCE && cambiati)) {
+    pthread_mutex_lock_safe(&mtx);
+    pthread_cond_signal(&open_close_cassa_cond);
+    pthread_mutex_unlock_safe(&mtx);
+  }
 }
 
 /*
@@ -183,16 +230,107 @@ void terminate_direttore(void) {
   pthread_mutex_unlock_safe(&mtx);
 
   pthread_join(thread_id, NULL);
-  free(in_coda);
+  /* i thread dei cassieri sono terminati (vedi close_supermercato()), quindi
+   * tutte le richieste sono state eseguite */
+  assert(aperture_in_corso == 0 && chiusure_in_corso == 0);
+  printf("DIRETTORE: permessi di uscita concessi = %d.\n", atomic_load(&permessi));
+  stato_code_free(&code);
+}
+
+/*
+ * Gli aggregati sono codificati in un'unica parola a 64 bit: scariche nei 32
+ * bit meno significativi e sovraccariche nei 32 più significativi, entrambi
+ * sommati a BIAS. Con il BIAS i campi non sono mai negativi, neanche
+ * temporaneamente (aggiornamenti concorrenti dello stesso slot possono
+ * applicare le variazioni in ordine diverso), quindi un'unica addizione
+ * atomica aggiorna entrambi i campi senza riporti dall'uno all'altro.
+ */
+#define BIAS ((int64_t)1 << 31)
+
+static uint64_t codifica(int64_t scariche, int64_t sovraccariche) {
+  return (uint64_t)(scariche + BIAS) + ((uint64_t)(sovraccariche + BIAS) << 32);
+}
+
+/*
+ * Inizializza lo stato delle code di 'max_casse' casse, inizialmente vuote,
+ * per la soglia di apertura s2.
+ */
+void stato_code_init(stato_code_t *code, unsigned int max_casse, int s2) {
+  assert(code != NULL);
+  code->in_coda = (slot_coda_t*) aligned_alloc(64, sizeof(slot_coda_t)*max_casse);
+  if (code->in_coda == NULL) {
+    handle_error("stato_code_init aligned_alloc");
+  }
+  for (unsigned int i=0; i<max_casse; i++) {
+    atomic_init(&code->in_coda[i].n, 0);
+  }
+  code->max_casse = max_casse;
+  code->s2 = s2;
+  atomic_init(&code->aggregati, codifica(max_casse, 0 >= s2 ? max_casse : 0));
+}
+
+void stato_code_free(stato_code_t *code) {
+  assert(code != NULL);
+  free(code->in_coda);
+  code->in_coda = NULL;
+}
+
+/*
+ * Registra la comunicazione di n clienti in coda alla cassa i, aggiornando
+ * gli aggregati in tempo costante e senza acquisire lock.
+ * Restituisce: un valore != 0 se gli aggregati sono cambiati, 0 altrimenti.
+ */
+int stato_code_aggiorna(stato_code_t *code, unsigned int i, int n) {
+  assert(code != NULL && code->in_coda != NULL);
+  assert(i < code->max_casse);
+  int prec = atomic_exchange(&code->in_coda[i].n, n);
+  int64_t scariche = (n <= 1) - (prec <= 1);
+  int64_t sovraccariche = (n >= code->s2) - (prec >= code->s2);
+  if (scariche == 0 && sovraccariche == 0) {
+    return 0; /* caso comune: nessuna soglia attraversata */
+  }
+  atomic_fetch_add(&code->aggregati,
+      (uint64_t)(scariche + sovraccariche*((int64_t)1 << 32)));
+  return 1;
+}
+
+/*
+ * Restituisce gli aggregati delle code, letti con un'unica operazione
+ * atomica: i due valori sono consistenti tra loro.
+ */
+aggregati_t stato_code_aggregati(stato_code_t *code) {
+  assert(code != NULL);
+  uint64_t v = atomic_load(&code->aggregati);
+  aggregati_t a;
+  a.scariche = (int)((int64_t)(v & 0xffffffffu) - BIAS);
+  a.sovraccariche = (int)((int64_t)(v >> 32) - BIAS);
+  return a;
+}
+
+/*
+ * Restituisce il numero di casse con almeno s2 clienti in coda secondo le
+ * ultime comunicazioni dei cassieri: se è maggiore di 0 è necessario aprire
+ * una cassa.
+ */
+int casse_sovraccariche(stato_code_t *code) {
+  return stato_code_aggregati(code).sovraccariche;
+}
+
+/*
+ * Restituisce 1 se almeno s1 casse hanno al più un cliente in coda, secondo
+ * le ultime comunicazioni dei cassieri.
+ */
+int soglia_chiusura(stato_code_t *code, int s1) {
+  return stato_code_aggregati(code).scariche >= s1;
 }
 
 /*
  * Comunica (il cliente) con il direttore la volontà di voler uscire dal
  * supermercato.
- * Il permesso è concesso se la funzione termina con successo.
+ * Il permesso è concesso se la funzione termina con successo: la richiesta
+ * non acquisisce lock, quindi non è mai bloccante (anche per le coroutine) e
+ * non contende con le comunicazioni dei cassieri.
  */
 void get_permesso(void) {
-  pthread_mutex_lock_safe(&mtx);
-  /* dummy lock acquire to simulate a request */
-  pthread_mutex_unlock_safe(&mtx);
+  atomic_fetch_add(&permessi, 1);
 }
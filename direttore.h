@@ -1,17 +1,59 @@
 #ifndef _DIRETTORE_H
 #define _DIRETTORE_H
+#include <stdatomic.h>
+#include <stdint.h>
 
 /*
  * Definisce le funzionalità del thread direttore
  */
 
+/* comunicazioni dei cassieri tra due aperture/chiusure di casse */
+#define PATIENCE 25
+
 struct cassiere;
 struct supermercato;
 
+/*
+ * Ultima comunicazione di un cassiere al direttore: ogni slot occupa una
+ * linea di cache, quindi le comunicazioni di cassieri diversi non si
+ * contendono la stessa linea.
+ */
+typedef struct slot_coda {
+  _Alignas(64) atomic_int n; /* clienti in coda */
+}slot_coda_t;
+
+/* Aggregati delle code utilizzati dalle decisioni del direttore */
+typedef struct aggregati {
+  int scariche;           /* casse con al più un cliente in coda */
+  int sovraccariche;      /* casse con almeno s2 clienti in coda */
+}aggregati_t;
+
+/*
+ * Ultime comunicazioni dei cassieri al direttore. Gli aggregati utilizzati
+ * dalle decisioni del direttore sono aggiornati a ogni comunicazione (vedi
+ * stato_code_aggiorna()), quindi le soglie di apertura e chiusura sono
+ * valutate in tempo costante, indipendentemente dal numero di casse.
+ * Le comunicazioni non acquisiscono lock: gli slot e gli aggregati sono
+ * aggiornati con operazioni atomiche, e gli aggregati sono codificati in
+ * un'unica parola, letta in modo consistente (vedi stato_code_aggregati()).
+ */
+typedef struct stato_code {
+  slot_coda_t *in_coda;   /* indicizzato dall'id dei cassieri */
+  unsigned int max_casse;
+  int s2;                 /* soglia di apertura */
+  _Atomic uint64_t aggregati; /* scariche e sovraccariche (modificati raramente) */
+}stato_code_t;
+
 void init_direttore(struct supermercato *supermercato, int s1, int s2);
 void comunica_numero_clienti(const struct cassiere *cassiere, int n);
 void terminate_direttore(void);
 void get_permesso(void);
+void stato_code_init(stato_code_t *code, unsigned int max_casse, int s2);
+void stato_code_free(stato_code_t *code);
+int stato_code_aggiorna(stato_code_t *code, unsigned int i, int n);
+aggregati_t stato_code_aggregati(stato_code_t *code);
+int casse_sovraccariche(stato_code_t *code);
+int soglia_chiusura(stato_code_t *code, int s1);
 
 
 
@@ -0,0 +1,331 @@
+#include "ilist.h"
+#include "defines.h"
+#include <stdlib.h>
+#include <assert.h>
+#include <time.h>
+/*
+ * Il file ilist.c implementa una lista doppiamente collegata intrusiva,
+ * utilizzata come coda FIFO. I nodi sono forniti dal chiamante (tipicamente
+ * come campo della struttura dell'elemento), quindi la lista non alloca
+ * memoria per i propri elementi e non è responsabile della loro
+ * deallocazione.
+ * Ogni nodo mantiene un riferimento alla lista in cui è inserito: la rimozione
+ * di un nodo da una posizione arbitraria è O(1) e fallisce in modo sicuro se
+ * il nodo è già stato estratto da un altro thread.
+ * Tutte le operazioni sono sincronizzate dal mutex della lista, ad eccezione
+ * di ilist_size() e ilist_empty(), che leggono il contatore atomico degli
+ * elementi, e di ilist_push().
+ *
+ * ilist_push() non acquisisce il lock: i produttori inseriscono il nodo in
+ * testa a una pila lock-free (list->inbox) con una compare-and-swap, e ogni
+ * operazione che acquisisce il lock sposta per prima cosa l'intera pila, in
+ * ordine di inserimento, in fondo alla lista (vedi collect_locked()). I nodi
+ * nella pila appartengono già alla lista: sono contati in list->size e
+ * node->list vale list.
+ * I produttori acquisiscono il lock soltanto per risvegliare un thread in
+ * attesa in ilist_pop_wait().
+ */
+
+/*
+ * Collega in fondo alla lista i nodi inseriti nella pila list->inbox,
+ * nell'ordine in cui sono stati inseriti.
+ * Deve essere chiamata con il lock della lista già acquisito.
+ */
+static void collect_locked(ilist_t *list) {
+  ilist_node_t *node = atomic_exchange_explicit(&list->inbox, NULL, memory_order_acquire);
+  if (node == NULL) {
+    return;
+  }
+
+  /* la pila parte dal nodo più recente, che diventa la coda della lista:
+   * la catena è invertita collegando ogni nodo davanti al precedente */
+  ilist_node_t *last = node;
+  ilist_node_t *first = NULL;
+  while (node != NULL) {
+    ilist_node_t *next = node->next;
+    node->next = first;
+    if (first != NULL) {
+      first->prev = node;
+    }
+    first = node;
+    node = next;
+  }
+
+  first->prev = list->tail;
+  if (list->tail != NULL) {
+    list->tail->next = first;
+  }
+  else { /* lista vuota */
+    list->head = first;
+  }
+  list->tail = last;
+}
+
+/*
+ * Scollega un nodo dalla lista.
+ * Deve essere chiamata con il lock della lista già acquisito.
+ */
+static void unlink_locked(ilist_t *list, ilist_node_t *node) {
+  assert(node->list == list);
+
+  if (node->prev != NULL) {
+    node->prev->next = node->next;
+  }
+  else {
+    list->head = node->next;
+  }
+  if (node->next != NULL) {
+    node->next->prev = node->prev;
+  }
+  else {
+    list->tail = node->prev;
+  }
+
+  node->prev = NULL;
+  node->next = NULL;
+  node->list = NULL;
+  atomic_fetch_sub_explicit(&list->size, 1, memory_order_release);
+}
+
+/*
+ * Inizializza un nodo non appartenente ad alcuna lista.
+ */
+void ilist_node_init(ilist_node_t *node) {
+  assert(node != NULL);
+  node->prev = NULL;
+  node->next = NULL;
+  node->list = NULL;
+}
+
+/*
+ * Crea una lista vuota.
+ * Restituisce: un puntatore alla lista creata.
+ *
+ * POST: ilist_empty(ilist_create()) == TRUE
+ */
+ilist_t *ilist_create(void) {
+  ilist_t *list = (ilist_t*) aligned_alloc(64, sizeof(ilist_t));
+  if (list == NULL) {
+    handle_error("malloc ilist_create");
+  }
+
+  list->head = NULL;
+  list->tail = NULL;
+  atomic_init(&list->inbox, NULL);
+  atomic_init(&list->size, 0);
+  atomic_init(&list->waiting, 0);
+  list->interrupted = 0;
+  pthread_mutex_init_ec(&list->mtx, NULL);
+  pthread_cond_init(&list->not_empty_cond, NULL);
+  return list;
+}
+
+/*
+ * Determina se la lista è vuota, senza acquisire il lock.
+ * Restituisce: un valore != 0 se la lista è vuota, 0 altrimenti.
+ */
+int ilist_empty(ilist_t *list) {
+  return ilist_size(list) == 0;
+}
+
+/*
+ * Inserisce un nodo in fondo alla lista.
+ * Il nodo non deve appartenere ad alcuna lista.
+ * La funzione è lock-free e può essere chiamata da più thread
+ * contemporaneamente; risveglia un eventuale thread in attesa in
+ * ilist_pop_wait().
+ */
+void ilist_push(ilist_t *list, ilist_node_t *node) {
+  assert(list != NULL && node != NULL);
+  assert(node->list == NULL);
+
+  node->list = list;
+  node->prev = NULL;
+  /* Il contatore è incrementato prima di pubblicare il nodo, in modo che la
+   * dimensione non risulti mai inferiore al numero di nodi estraibili. */
+  atomic_fetch_add_explicit(&list->size, 1, memory_order_release);
+  ilist_node_t *first = atomic_load_explicit(&list->inbox, memory_order_relaxed);
+  do {
+    node->next = first;
+  } while (!atomic_compare_exchange_weak_explicit(&list->inbox, &first, node,
+        memory_order_release, memory_order_relaxed));
+
+  /* Il fence impedisce che la lettura di waiting sia anticipata rispetto alla
+   * pubblicazione del nodo: chi attende incrementa waiting prima di
+   * controllare la pila, quindi almeno uno dei due thread osserva la modifica
+   * dell'altro e il risveglio non può essere perso. */
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load_explicit(&list->waiting, memory_order_relaxed) > 0) {
+    pthread_mutex_lock_safe(&list->mtx); /* lock */
+    pthread_cond_signal(&list->not_empty_cond);
+    pthread_mutex_unlock_safe(&list->mtx); /* unlock */
+  }
+}
+
+/*
+ * Estrae e restituisce il primo nodo della lista.
+ * Se la lista è vuota restituisce NULL.
+ */
+ilist_node_t *ilist_pop(ilist_t *list) {
+  assert(list != NULL);
+
+  pthread_mutex_lock_safe(&list->mtx); /* lock */
+  collect_locked(list);
+  ilist_node_t *node = list->head;
+  if (node != NULL) {
+    unlink_locked(list, node);
+  }
+  pthread_mutex_unlock_safe(&list->mtx); /* unlock */
+
+  return node;
+}
+
+/*
+ * Estrae e restituisce il primo nodo della lista. Se la lista è vuota attende
+ * l'inserimento di un nuovo nodo per al più 'timeout_ms' millisecondi.
+ * Restituisce NULL se il tempo è scaduto o se l'attesa è stata interrotta da
+ * ilist_interrupt().
+ */
+ilist_node_t *ilist_pop_wait(ilist_t *list, int timeout_ms) {
+  assert(list != NULL);
+
+  struct timespec deadline;
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += timeout_ms / 1000;
+  deadline.tv_nsec += (long)(timeout_ms % 1000)*1000*1000;
+  if (deadline.tv_nsec >= 1000*1000*1000) {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000*1000*1000;
+  }
+
+  pthread_mutex_lock_safe(&list->mtx); /* lock */
+  atomic_fetch_add_explicit(&list->waiting, 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst); /* vedi ilist_push() */
+  collect_locked(list);
+  while (list->head == NULL && !list->interrupted && timeout_ms > 0) {
+    int rc = pthread_cond_timedwait(&list->not_empty_cond, &list->mtx, &deadline);
+    collect_locked(list);
+    if (rc == ETIMEDOUT) {
+      break;
+    }
+  }
+  atomic_fetch_sub_explicit(&list->waiting, 1, memory_order_relaxed);
+  list->interrupted = 0; /* l'interruzione è consumata dall'attesa */
+
+  ilist_node_t *node = list->head;
+  if (node != NULL) {
+    unlink_locked(list, node);
+  }
+  pthread_mutex_unlock_safe(&list->mtx); /* unlock */
+
+  return node;
+}
+
+/*
+ * Estrae tutti i nodi della lista con un'unica acquisizione del lock.
+ * Restituisce: il primo nodo della catena estratta, NULL se la lista è vuota.
+ * I nodi restano collegati tra loro tramite il campo next, nell'ordine in cui
+ * si trovavano nella lista, ma non appartengono più ad alcuna lista: il
+ * chiamante deve leggere node->next prima di reinserire 'node' in una lista.
+ */
+ilist_node_t *ilist_drain(ilist_t *list) {
+  assert(list != NULL);
+
+  pthread_mutex_lock_safe(&list->mtx); /* lock */
+  collect_locked(list);
+  ilist_node_t *first = list->head;
+  for (ilist_node_t *node = first; node != NULL; node = node->next) {
+    node->prev = NULL;
+    node->list = NULL; /* ilist_remove() sul nodo fallisce */
+  }
+  list->head = NULL;
+  list->tail = NULL;
+  atomic_store_explicit(&list->size, 0, memory_order_release);
+  pthread_mutex_unlock_safe(&list->mtx); /* unlock */
+
+  return first;
+}
+
+/*
+ * Interrompe l'attesa corrente o la successiva di un thread in
+ * ilist_pop_wait(), che restituisce il controllo anche se la lista è vuota.
+ */
+void ilist_interrupt(ilist_t *list) {
+  assert(list != NULL);
+  pthread_mutex_lock_safe(&list->mtx); /* lock */
+  list->interrupted = 1;
+  pthread_cond_signal(&list->not_empty_cond);
+  pthread_mutex_unlock_safe(&list->mtx); /* unlock */
+}
+
+/*
+ * Restituisce il primo nodo della lista senza estrarlo.
+ * Se la lista è vuota restituisce NULL.
+ * Nota: il nodo restituito potrebbe essere estratto da un altro thread subito
+ * dopo il rilascio del lock.
+ */
+ilist_node_t *ilist_top(ilist_t *list) {
+  assert(list != NULL);
+  pthread_mutex_lock_safe(&list->mtx); /* lock */
+  collect_locked(list);
+  ilist_node_t *node = list->head;
+  pthread_mutex_unlock_safe(&list->mtx); /* unlock */
+  return node;
+}
+
+/*
+ * Restituisce il nodo che segue 'node' nella lista senza estrarlo.
+ * Se 'node' è l'ultimo nodo o non appartiene (più) alla lista, restituisce
+ * NULL.
+ * Nota: come per ilist_top(), il nodo restituito potrebbe essere estratto da
+ * un altro thread subito dopo il rilascio del lock.
+ */
+ilist_node_t *ilist_next(ilist_t *list, ilist_node_t *node) {
+  assert(list != NULL && node != NULL);
+  pthread_mutex_lock_safe(&list->mtx); /* lock */
+  collect_locked(list);
+  ilist_node_t *next = node->list == list ? node->next : NULL;
+  pthread_mutex_unlock_safe(&list->mtx); /* unlock */
+  return next;
+}
+
+/*
+ * Rimuove il nodo 'node' dalla lista, in qualsiasi posizione si trovi, in
+ * tempo costante.
+ * Restituisce: 0 se il nodo è stato rimosso, -1 se il nodo non appartiene
+ * (più) alla lista, ad esempio perchè già estratto da un altro thread.
+ */
+int ilist_remove(ilist_t *list, ilist_node_t *node) {
+  assert(list != NULL && node != NULL);
+
+  pthread_mutex_lock_safe(&list->mtx); /* lock */
+  collect_locked(list); /* il nodo potrebbe essere ancora nella pila */
+  if (node->list != list) {
+    pthread_mutex_unlock_safe(&list->mtx); /* unlock */
+    return -1;
+  }
+  unlink_locked(list, node);
+  pthread_mutex_unlock_safe(&list->mtx); /* unlock */
+  return 0;
+}
+
+/*
+ * Restituisce il numero di elementi contenuti nella lista.
+ * La lettura non acquisisce il lock della lista.
+ */
+size_t ilist_size(ilist_t *list) {
+  assert(list != NULL);
+  return atomic_load_explicit(&list->size, memory_order_acquire);
+}
+
+/*
+ * Libera le risorse allocate dalla lista. I nodi ancora presenti vengono
+ * scollegati, ma non deallocati.
+ */
+void ilist_free(ilist_t *list) {
+  assert(list != NULL);
+  ilist_drain(list);
+  pthread_mutex_destroy(&list->mtx);
+  pthread_cond_destroy(&list->not_empty_cond);
+  free(list);
+}
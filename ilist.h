@@ -0,0 +1,58 @@
+#ifndef ILIST_H
+#define ILIST_H
+#include <stdlib.h> /* size_t */
+#include <stddef.h> /* offsetof */
+#include <stdatomic.h>
+#include <pthread.h>
+
+/*
+ * Lista FIFO intrusiva e thread-safe: il collegamento (ilist_node_t) è
+ * contenuto nella struttura dell'elemento, quindi inserimenti ed estrazioni
+ * non effettuano allocazioni e un elemento può essere rimosso in O(1) da
+ * qualsiasi posizione della lista.
+ * Gli inserimenti sono lock-free: i nodi sono raccolti in una pila atomica
+ * (inbox) e collegati alla lista dalla successiva operazione che ne acquisisce
+ * il lock.
+ * Un nodo può appartenere al più a una lista alla volta.
+ */
+
+struct ilist;
+
+typedef struct ilist_node {
+  struct ilist_node *prev;
+  struct ilist_node *next;
+  struct ilist *list; /* lista di appartenenza, NULL se il nodo non è in lista */
+}ilist_node_t;
+
+typedef struct ilist {
+  ilist_node_t *head;
+  ilist_node_t *tail;
+  /* nodi inseriti e non ancora collegati, dal più recente (vedi ilist_push) */
+  _Alignas(64) _Atomic(ilist_node_t*) inbox;
+  atomic_size_t size; /* numero di elementi (inbox compresa), leggibile senza lock */
+  atomic_int waiting; /* numero di thread in attesa in ilist_pop_wait */
+  int interrupted;    /* attesa interrotta da ilist_interrupt */
+  pthread_mutex_t mtx;
+  pthread_cond_t not_empty_cond;
+}ilist_t;
+
+/* Restituisce il puntatore alla struttura di tipo 'type' che contiene il nodo
+ * 'node' nel campo 'member'. */
+#define ilist_entry(node, type, member) \
+  ((type*)((char*)(node) - offsetof(type, member)))
+
+void ilist_node_init(ilist_node_t *node);
+ilist_t *ilist_create(void);
+int ilist_empty(ilist_t *list);
+void ilist_push(ilist_t *list, ilist_node_t *node);
+ilist_node_t *ilist_pop(ilist_t *list);
+ilist_node_t *ilist_pop_wait(ilist_t *list, int timeout_ms);
+ilist_node_t *ilist_drain(ilist_t *list);
+void ilist_interrupt(ilist_t *list);
+ilist_node_t *ilist_top(ilist_t *list);
+ilist_node_t *ilist_next(ilist_t *list, ilist_node_t *node);
+int ilist_remove(ilist_t *list, ilist_node_t *node);
+size_t ilist_size(ilist_t *list);
+void ilist_free(ilist_t *list);
+
+#endif
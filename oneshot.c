@@ -0,0 +1,106 @@
+#include "oneshot.h"
+#include "defines.h"
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <limits.h>
+#include <assert.h>
+
+static void futex_wait(atomic_int *addr, int val) {
+  /* EAGAIN: il valore è già cambiato, EINTR: interrotto da un segnale */
+  if (syscall(SYS_futex, (int*)addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0) == -1
+      && errno != EAGAIN && errno != EINTR) {
+    handle_error("futex wait");
+  }
+}
+
+/*
+ * Risveglia i thread in attesa sul futex 'addr'. La memoria del futex può già
+ * essere stata riutilizzata o liberata dal thread risvegliato (vedi
+ * oneshot_set()): EFAULT ed EINTR non sono quindi errori.
+ */
+static void futex_wake(atomic_int *addr) {
+  if (syscall(SYS_futex, (int*)addr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0) == -1
+      && errno != EFAULT && errno != EINTR) {
+    handle_error("futex wake");
+  }
+}
+
+/*
+ * Registra la coroutine 'co', già sospesa, in attesa dell'evento 'arg'; se
+ * nel frattempo l'evento è stato segnalato, la coroutine è ripresa subito.
+ */
+static void dopo_wait(coroutine_t *co, void *arg) {
+  oneshot_t *evento = (oneshot_t*) arg;
+  int atteso = ONESHOT_VUOTO;
+  evento->attesa = co;
+  if (!atomic_compare_exchange_strong(&evento->stato, &atteso, ONESHOT_COROUTINE)) {
+    assert(atteso == ONESHOT_SEGNALATO);
+    coroutine_unpark(co);
+  }
+}
+
+void oneshot_init(oneshot_t *evento) {
+  assert(evento != NULL);
+  atomic_init(&evento->stato, ONESHOT_VUOTO);
+  evento->attesa = NULL;
+}
+
+/*
+ * Attende che l'evento sia segnalato; termina subito se l'evento è già
+ * segnalato. Chiamata da una coroutine, la sospende anzichè bloccare il thread.
+ */
+void oneshot_wait(oneshot_t *evento) {
+  assert(evento != NULL);
+  if (atomic_load(&evento->stato) == ONESHOT_SEGNALATO) {
+    return;
+  }
+
+  if (coroutine_self() != NULL) {
+    coroutine_park(dopo_wait, (void*)evento);
+    assert(atomic_load(&evento->stato) == ONESHOT_SEGNALATO);
+    return;
+  }
+
+  int atteso = ONESHOT_VUOTO;
+  if (atomic_compare_exchange_strong(&evento->stato, &atteso, ONESHOT_THREAD)) {
+    while (atomic_load(&evento->stato) == ONESHOT_THREAD) {
+      futex_wait(&evento->stato, ONESHOT_THREAD);
+    }
+  }
+  assert(atomic_load(&evento->stato) == ONESHOT_SEGNALATO);
+}
+
+/*
+ * Segnala l'evento, risvegliando il thread o la coroutine in attesa.
+ * Non è mai bloccante. Un thread in attesa può osservare la segnalazione
+ * prima della FUTEX_WAKE (ad esempio per un risveglio spurio) e riutilizzare
+ * o liberare la memoria dell'evento mentre la chiamata è ancora in corso: la
+ * FUTEX_WAKE può quindi fallire con EFAULT, oppure risvegliare un'attesa
+ * successiva sullo stesso indirizzo, che ricontrolla lo stato e torna in
+ * attesa (vedi oneshot_wait()). Per questo, se in attesa c'è un thread,
+ * l'evento non è acceduto dopo lo scambio dello stato.
+ */
+void oneshot_set(oneshot_t *evento) {
+  assert(evento != NULL);
+  int prec = atomic_exchange(&evento->stato, ONESHOT_SEGNALATO);
+  assert(prec != ONESHOT_SEGNALATO);
+  if (prec == ONESHOT_THREAD) {
+    futex_wake(&evento->stato);
+  }
+  else if (prec == ONESHOT_COROUTINE) {
+    /* la coroutine non può riprendere prima della chiamata */
+    coroutine_unpark(evento->attesa);
+  }
+}
+
+/*
+ * Riporta l'evento segnalato allo stato iniziale, per una nuova attesa.
+ * Deve essere chiamata dal thread che ha atteso l'evento.
+ */
+void oneshot_reset(oneshot_t *evento) {
+  assert(evento != NULL);
+  assert(atomic_load(&evento->stato) == ONESHOT_SEGNALATO);
+  atomic_store(&evento->stato, ONESHOT_VUOTO);
+  evento->attesa = NULL;
+}
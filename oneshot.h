@@ -0,0 +1,35 @@
+#ifndef ONESHOT_H
+#define ONESHOT_H
+#include <stdatomic.h>
+#include "coroutine.h"
+
+/*
+ * Evento a segnalazione singola tra un thread (o una coroutine) in attesa e
+ * un thread che lo segnala, basato su futex: non richiede mutex nè variabili
+ * di condizione e la segnalazione non acquisisce alcun lock.
+ * Un solo thread alla volta può attendere l'evento; dopo la segnalazione
+ * l'evento resta segnalato finchè il thread in attesa non lo reimposta con
+ * oneshot_reset(), quindi una segnalazione precedente all'attesa non viene
+ * persa.
+ * Una coroutine in attesa si sospende senza occupare il thread che la esegue
+ * (vedi coroutine_park()).
+ */
+
+enum {
+  ONESHOT_VUOTO,      /* non segnalato, nessuno in attesa */
+  ONESHOT_SEGNALATO,  /* segnalato */
+  ONESHOT_THREAD,     /* un thread è in attesa sul futex */
+  ONESHOT_COROUTINE   /* la coroutine 'attesa' è sospesa in attesa */
+};
+
+typedef struct oneshot {
+  atomic_int stato;       /* parola del futex */
+  coroutine_t *attesa;    /* coroutine in attesa (ONESHOT_COROUTINE) */
+}oneshot_t;
+
+void oneshot_init(oneshot_t *evento);
+void oneshot_wait(oneshot_t *evento);
+void oneshot_set(oneshot_t *evento);
+void oneshot_reset(oneshot_t *evento);
+
+#endif
@@ -11,6 +11,11 @@ static const char* params_names[N_PARAMS] = {
   "C", "E", "K", "I", "T", "P", "TP", "S", "S1", "S2"
 };
 
+/* Valori della chiave ROUTING, nell'ordine di enum routing_policy */
+static const char* routing_names[N_ROUTING] = {
+  "random", "jsq", "p2c", "lew"
+};
+
 /* Rimuove (in place) gli spazi finali di una stringa */
 static char *trim(char *s) {
   char *tmp = s + strlen(s);
@@ -39,6 +44,11 @@ void parse_config(const char *path, config_t *config) {
   for (int i=0; i<N_PARAMS; i++) {
     config->params[i] = UNDEFINED_PARAM;
   }
+  config->SPEED = 1; /* tempo simulato uguale al tempo reale */
+  config->ROUTING = ROUTING_RANDOM;
+  config->JOCKEY = 0; /* i clienti cambiano coda soltanto alla chiusura della cassa */
+  config->JOCKEY_SOGLIA = 2;
+  config->SEED = 1;
 
   while(fgets(line, 80, file) != NULL) {
     // printf("%s", line);
@@ -60,6 +70,32 @@ void parse_config(const char *path, config_t *config) {
         config->LOG = (char *)malloc(sizeof(char)*(strlen(log_file)+1));
         strcpy(config->LOG, log_file);
       }
+
+      if (!strcmp(key, "SPEED")) {
+        config->SPEED = strtod(value, NULL);
+      }
+
+      if (!strcmp(key, "SEED")) {
+        config->SEED = strtoull(value, NULL, 10);
+      }
+
+      if (!strcmp(key, "JOCKEY")) {
+        config->JOCKEY = atoi(value);
+      }
+
+      if (!strcmp(key, "JOCKEY_SOGLIA")) {
+        config->JOCKEY_SOGLIA = atoi(value);
+      }
+
+      if (!strcmp(key, "ROUTING")) {
+        char *policy = trim(value);
+        config->ROUTING = UNDEFINED_PARAM;
+        for (int i=0; i<N_ROUTING; i++) {
+          if (!strcmp(policy, routing_names[i])) {
+            config->ROUTING = i;
+          }
+        }
+      }
     }
   }
 
@@ -67,6 +103,10 @@ void parse_config(const char *path, config_t *config) {
   for (int i=0; i<N_PARAMS; i++) {
     assert(config->params[i] != UNDEFINED_PARAM);
   }
+  assert(config->SPEED > 0);
+  assert(config->ROUTING != UNDEFINED_PARAM); /* politica sconosciuta */
+  assert(config->JOCKEY >= 0);
+  assert(config->JOCKEY_SOGLIA >= 0);
 
   fclose(file);
 }
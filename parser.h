@@ -1,5 +1,6 @@
 #ifndef PARSER_H
 #define PARSER_H
+#include <stdint.h>
 
 #define UNDEFINED_PARAM (-1)
 
@@ -17,6 +18,15 @@ enum config_params {
   N_PARAMS /* numero di parametri configurabili */
 };
 
+/* Politiche di scelta della cassa da parte dei clienti (chiave ROUTING) */
+enum routing_policy {
+  ROUTING_RANDOM, /* cassa aperta casuale (default) */
+  ROUTING_JSQ,    /* cassa con la coda più corta (join-shortest-queue) */
+  ROUTING_P2C,    /* la coda più corta tra due casse casuali (power-of-two-choices) */
+  ROUTING_LEW,    /* cassa con il minor lavoro atteso in coda (prodotti * TP) */
+  N_ROUTING
+};
+
 /*
  * Parametri di configurazione della simulazione.
  * Le lettere maiuscole per i campi sono utilizzate per congruenza con il testo
@@ -25,6 +35,13 @@ enum config_params {
 typedef struct config {
   int params[N_PARAMS]; /* parametri configurabili */
   char *LOG; /* nome del file di log */
+  double SPEED; /* fattore di scala del tempo (opzionale, default 1) */
+  int ROUTING;  /* routing_policy (opzionale, default ROUTING_RANDOM) */
+  int JOCKEY;   /* massimo numero di cambi di coda volontari (opzionale, default 0) */
+  /* clienti in meno, rispetto a quelli che precedono il cliente, che una coda
+   * deve avere perchè il cliente vi si sposti (opzionale, default 2) */
+  int JOCKEY_SOGLIA;
+  uint64_t SEED; /* seed dei generatori casuali (opzionale, default 1) */
 }config_t;
 
 void parse_config(const char *path, config_t *config);
@@ -2,17 +2,81 @@
 #include "defines.h"
 #include <stdlib.h>
 #include <assert.h>
+#include <time.h>
 /*
  * Il file queue.c implementa l'interfaccia verso la api definita nell'header
  * queue.h. La coda implementata è unidirezionale e implementa le funzionalità
  * di push, pop, top, size e empty, ognuna descritta dalle rispettive
- * implementazioni.
+ * implementazioni. queue_push_batch() e queue_drain() inseriscono ed estraggono
+ * più elementi con un'unica acquisizione del lock.
  * queue_t è thread-safe nelle sue operazioni di base, che garantiscono
  * l'esecuzione atomica delle istruzioni contenute. Per questo motivo la coda
  * è sempre passata alle funzioni come puntatore (a dati non costanti) poichè
  * il lock è contenuto all'interno di queue_t ed è unico per ogni coda.
+ * I nodi estratti dalla coda non vengono deallocati, ma sono mantenuti in una
+ * lista di nodi liberi riutilizzata dagli inserimenti successivi: a regime
+ * push e pop non effettuano chiamate all'allocatore.
+ * Una coda creata con queue_create_bounded() memorizza invece gli elementi in
+ * un buffer circolare di capacità fissa: gli inserimenti in una coda piena
+ * sono bloccanti (queue_push), falliscono immediatamente (queue_try_push)
+ * oppure attendono al più un tempo prefissato (queue_push_timed).
  */
 
+/*
+ * Calcola l'istante assoluto (CLOCK_REALTIME) che si trova 'ms' millisecondi
+ * nel futuro, da usare come scadenza per pthread_cond_timedwait().
+ */
+static struct timespec deadline_ms(int ms) {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  ts.tv_sec += ms / 1000;
+  ts.tv_nsec += (long)(ms % 1000)*1000*1000;
+  if (ts.tv_nsec >= 1000*1000*1000) {
+    ts.tv_sec++;
+    ts.tv_nsec -= 1000*1000*1000;
+  }
+  return ts;
+}
+
+/*
+ * Ottiene un nodo libero dalla lista dei nodi inutilizzati della coda, oppure
+ * ne alloca uno nuovo se la lista è vuota.
+ * Deve essere chiamata con il lock della coda già acquisito.
+ */
+static queue_node_t *node_get(queue_t *queue) {
+  queue_node_t *node = queue->free_nodes;
+  if (node != NULL) {
+    queue->free_nodes = node->next;
+    return node;
+  }
+
+  /* lista vuota: la coda cresce oltre il numero massimo di nodi raggiunto */
+  node = (queue_node_t *) malloc(sizeof(queue_node_t));
+  if (node == NULL) {
+    handle_error("malloc queue_push");
+  }
+  return node;
+}
+
+/*
+ * Restituisce un nodo alla lista dei nodi inutilizzati della coda.
+ * Deve essere chiamata con il lock della coda già acquisito.
+ */
+static void node_put(queue_t *queue, queue_node_t *node) {
+  node->value = NULL;
+  node->next = queue->free_nodes;
+  queue->free_nodes = node;
+}
+
+/*
+ * Determina se un nodo appartiene al blocco preallocato della coda.
+ */
+static int node_in_slab(const queue_t *queue, const queue_node_t *node) {
+  return queue->slab != NULL
+    && node >= queue->slab
+    && node < queue->slab + queue->slab_size;
+}
+
 /*
  * Crea una coda vuota.
  * Restituisce: un puntatore alla coda creata.
@@ -20,6 +84,17 @@
  * POST: queue_empty(queue_create()) == TRUE
  */
 queue_t *queue_create(void) {
+  return queue_create_sized(0);
+}
+
+/*
+ * Crea una coda vuota preallocando in un unico blocco 'prealloc' nodi, in modo
+ * che i primi 'prealloc' inserimenti non effettuino allocazioni dinamiche.
+ * Restituisce: un puntatore alla coda creata.
+ *
+ * POST: queue_empty(queue_create_sized(n)) == TRUE
+ */
+queue_t *queue_create_sized(size_t prealloc) {
   queue_t *queue = (queue_t *) malloc(sizeof(queue_t));
   if (queue == NULL) {
     handle_error("malloc queue_create");
@@ -27,13 +102,144 @@ queue_t *queue_create(void) {
 
   queue->head = NULL;
   queue->tail = NULL;
+  queue->free_nodes = NULL;
+  queue->slab = NULL;
+  queue->slab_size = 0;
+  queue->ring = NULL;
+  queue->capacity = 0;
+  queue->first = 0;
+  atomic_init(&queue->size, 0);
+
+  if (prealloc > 0) {
+    queue->slab = (queue_node_t *) malloc(sizeof(queue_node_t)*prealloc);
+    if (queue->slab == NULL) {
+      handle_error("malloc queue_create_sized");
+    }
+    queue->slab_size = prealloc;
+    /* inserisce i nodi del blocco nella lista dei nodi liberi */
+    for (size_t i=prealloc; i>0; i--) {
+      node_put(queue, &queue->slab[i - 1]);
+    }
+  }
+
   pthread_mutex_init_ec(&queue->mtx, NULL);
   pthread_cond_init(&queue->not_empty_cond, NULL);
+  pthread_cond_init(&queue->not_full_cond, NULL);
+  return queue;
+}
+
+/*
+ * Crea una coda vuota limitata, in grado di contenere al più 'capacity'
+ * elementi. Gli elementi sono memorizzati in un buffer circolare allocato
+ * alla creazione, quindi la memoria occupata dalla coda non cresce.
+ * Restituisce: un puntatore alla coda creata.
+ *
+ * PRE: capacity > 0
+ * POST: queue_empty(queue_create_bounded(n)) == TRUE
+ */
+queue_t *queue_create_bounded(size_t capacity) {
+  assert(capacity > 0);
+  queue_t *queue = queue_create_sized(0);
+
+  queue->ring = (void **) malloc(sizeof(void*)*capacity);
+  if (queue->ring == NULL) {
+    handle_error("malloc queue_create_bounded");
+  }
+  queue->capacity = capacity;
   return queue;
 }
 
+/*
+ * Inserisce un elemento in fondo alla coda, che non deve essere piena, senza
+ * risvegliare i thread in attesa.
+ * Deve essere chiamata con il lock della coda già acquisito.
+ */
+static void store_locked(queue_t *queue, void *value) {
+  size_t size = atomic_load_explicit(&queue->size, memory_order_relaxed);
+
+  if (queue->ring != NULL) { /* coda limitata */
+    assert(size < queue->capacity);
+    queue->ring[(queue->first + size) % queue->capacity] = value;
+  }
+  else {
+    /* La lista dei nodi liberi è condivisa: il nodo è ottenuto con il lock
+     * acquisito. L'allocazione avviene soltanto quando la lista è vuota. */
+    queue_node_t *node = node_get(queue);
+    node->value = value;
+    node->next = NULL;
+
+    if (queue->head == NULL) { /* coda vuota */
+      queue->head = node;
+      queue->tail = node;
+    }
+    else {
+      assert(queue->head != NULL);
+      assert(queue->tail != NULL);
+      queue->tail->next = node;
+      queue->tail = node;
+    }
+  }
+  atomic_fetch_add_explicit(&queue->size, 1, memory_order_release);
+}
+
+/*
+ * Inserisce un elemento in fondo alla coda, che non deve essere piena.
+ * Deve essere chiamata con il lock della coda già acquisito.
+ */
+static void push_locked(queue_t *queue, void *value) {
+  store_locked(queue, value);
+  pthread_cond_broadcast(&queue->not_empty_cond);
+}
+
+/*
+ * Estrae e restituisce il primo elemento della coda, che non deve essere vuota,
+ * senza risvegliare i thread in attesa di un posto libero.
+ * Deve essere chiamata con il lock della coda già acquisito.
+ */
+static void *take_locked(queue_t *queue) {
+  void *value;
+  assert(atomic_load_explicit(&queue->size, memory_order_relaxed) > 0);
+
+  if (queue->ring != NULL) { /* coda limitata */
+    value = queue->ring[queue->first];
+    queue->first = (queue->first + 1) % queue->capacity;
+  }
+  else {
+    assert(queue->head != NULL);
+    queue_node_t *node = queue->head;
+    value = node->value;
+    queue->head = node->next;
+    node_put(queue, node); /* il nodo sarà riutilizzato dalla prossima push */
+  }
+  atomic_fetch_sub_explicit(&queue->size, 1, memory_order_release);
+  return value;
+}
+
+/*
+ * Estrae e restituisce il primo elemento della coda, che non deve essere vuota.
+ * Deve essere chiamata con il lock della coda già acquisito.
+ */
+static void *pop_locked(queue_t *queue) {
+  void *value = take_locked(queue);
+  if (queue->ring != NULL) {
+    pthread_cond_signal(&queue->not_full_cond); /* si è liberato un posto */
+  }
+  return value;
+}
+
+/*
+ * Determina se la coda è piena. Una coda non limitata non è mai piena.
+ * Restituisce: un valore != 0 se la coda è piena, 0 altrimenti.
+ */
+int queue_full(queue_t *queue) {
+  assert(queue != NULL);
+  return queue->ring != NULL && queue_size(queue) >= queue->capacity;
+}
+
 /*
  * Determina se la coda in ingresso è vuota.
+ * La lettura è effettuata sul contatore atomico degli elementi e non acquisisce
+ * il lock della coda.
  * Restituisce: un valore != 0 se la coda è vuota, 0 altrimenti.
  */
 int queue_empty(queue_t *queue) {
@@ -41,15 +247,12 @@ int queue_empty(queue_t *queue) {
     handle_error("queue_empty: queue is NULL");
   }
 
-  pthread_mutex_lock_safe(&queue->mtx);
-  int empty = queue->head == NULL;
-  pthread_mutex_unlock_safe(&queue->mtx);
-
-  return empty;
+  return queue_size(queue) == 0;
 }
 
 /*
  * Inserisce un nuovo elemento in fondo alla coda.
+ * Se la coda è limitata e piena, attende che si liberi un posto.
  * Segnala ai thread in attesa sulla condition variable queue->not_empty_cond,
  * che un nuovo elemento è disponibile.
  */
@@ -59,36 +262,108 @@ void queue_push(queue_t *queue, void *value) {
     handle_error("queue_push: queue is NULL");
   }
 
-  queue_node_t *node = (queue_node_t *) malloc(sizeof(queue_node_t));
-  if (node == NULL) {
-    handle_error("malloc queue_push");
+  /* Per verificare che la coda sia piena non si può usare la funzione
+   * queue_full() al di fuori della sezione critica: il thread corrente
+   * potrebbe essere stato prerilasciato dallo scheduler e la condizione
+   * potrebbe non essere più verificata al momento dell'inserimento.
+   */
+  /* Sezione critica */
+  pthread_mutex_lock_safe(&queue->mtx); /* lock */
+  while (queue_full(queue)) {
+    pthread_cond_wait(&queue->not_full_cond, &queue->mtx);
+  }
+  push_locked(queue, value);
+  pthread_mutex_unlock_safe(&queue->mtx); /* unlock */
+}
+
+/*
+ * Inserisce un nuovo elemento in fondo alla coda senza bloccarsi.
+ * Restituisce: 0 se l'elemento è stato inserito, -1 se la coda è piena.
+ */
+int queue_try_push(queue_t *queue, void *value) {
+  assert(queue != NULL);
+
+  pthread_mutex_lock_safe(&queue->mtx); /* lock */
+  if (queue_full(queue)) {
+    pthread_mutex_unlock_safe(&queue->mtx); /* unlock */
+    return -1;
   }
+  push_locked(queue, value);
+  pthread_mutex_unlock_safe(&queue->mtx); /* unlock */
+  return 0;
+}
 
-  node->value = value;
-  node->next = NULL;
+/*
+ * Inserisce un nuovo elemento in fondo alla coda, attendendo al più
+ * 'timeout_ms' millisecondi che si liberi un posto se la coda è piena.
+ * Restituisce: 0 se l'elemento è stato inserito, ETIMEDOUT se allo scadere
+ * del tempo la coda è ancora piena.
+ */
+int queue_push_timed(queue_t *queue, void *value, int timeout_ms) {
+  assert(queue != NULL);
+  assert(timeout_ms >= 0);
+  struct timespec deadline = deadline_ms(timeout_ms);
 
-  /* Per verificare che la coda sia vuota non si può usare la funzione
-   * queue_empty() poichè internamente questa ottiene il lock associato alla
-   * coda, quindi per ottenere l'accesso esclusivo, la funzione corrente
-   * dovrebbe ottenere il lock all'interno del corpo dell'if (per evitare
-   * situazioni di deadlock). In questo caso però il thread corrente potrebbe
-   * essere stato prerilasciato dallo scheduler e la condizione di coda vuota
-   * potrebbe non essere più verificata. 
-   */
-  /* Sezione critica */
   pthread_mutex_lock_safe(&queue->mtx); /* lock */
-  if (queue->head == NULL) { /* coda vuota */
-    queue->head = node;
-    queue->tail = node;
+  while (queue_full(queue)) {
+    if (pthread_cond_timedwait(&queue->not_full_cond, &queue->mtx, &deadline) == ETIMEDOUT
+        && queue_full(queue)) {
+      pthread_mutex_unlock_safe(&queue->mtx); /* unlock */
+      return ETIMEDOUT;
+    }
   }
-  else {
-    assert(queue->head != NULL);
-    assert(queue->tail != NULL);
-    queue->tail->next = node;
-    queue->tail = node;
+  push_locked(queue, value);
+  pthread_mutex_unlock_safe(&queue->mtx); /* unlock */
+  return 0;
+}
+
+/*
+ * Inserisce in fondo alla coda, nell'ordine dato, gli 'n' elementi del vettore
+ * 'values', acquisendo il lock della coda una sola volta e risvegliando i
+ * thread in attesa al termine degli inserimenti.
+ * Se la coda è limitata, inserisce soltanto gli elementi per cui vi è posto,
+ * senza bloccarsi.
+ * Restituisce: il numero di elementi inseriti (n se la coda non è limitata).
+ */
+size_t queue_push_batch(queue_t *queue, void **values, size_t n) {
+  assert(queue != NULL);
+  assert(values != NULL || n == 0);
+
+  /* sezione critica */
+  pthread_mutex_lock_safe(&queue->mtx); /* lock */
+  size_t i = 0;
+  while (i < n && !queue_full(queue)) {
+    store_locked(queue, values[i++]);
+  }
+  if (i > 0) {
+    pthread_cond_broadcast(&queue->not_empty_cond);
+  }
+  pthread_mutex_unlock_safe(&queue->mtx); /* unlock */
+
+  return i;
+}
+
+/*
+ * Estrae dalla coda al più 'max' elementi, memorizzandone i valori nel vettore
+ * 'values' in ordine FIFO, acquisendo il lock della coda una sola volta.
+ * Restituisce: il numero di elementi estratti.
+ */
+size_t queue_drain(queue_t *queue, void **values, size_t max) {
+  assert(queue != NULL);
+  assert(values != NULL || max == 0);
+
+  /* sezione critica */
+  pthread_mutex_lock_safe(&queue->mtx); /* lock */
+  size_t n = 0;
+  while (n < max && !queue_empty(queue)) {
+    values[n++] = take_locked(queue);
+  }
+  if (n > 0 && queue->ring != NULL) {
+    pthread_cond_broadcast(&queue->not_full_cond); /* si sono liberati n posti */
   }
-  pthread_cond_broadcast(&queue->not_empty_cond);
   pthread_mutex_unlock_safe(&queue->mtx); /* unlock */
+
+  return n;
 }
 
 /*
@@ -104,20 +379,41 @@ void* queue_pop(queue_t *queue) {
   /* sezione critica */
   pthread_mutex_lock_safe(&queue->mtx); /* lock */
 
-  if (queue->head == NULL) { /* coda vuota */
+  if (queue_empty(queue)) { /* coda vuota */
     pthread_mutex_unlock_safe(&queue->mtx); /* unlock */
     return NULL;
   }
 
-  assert(queue->head != NULL);
-
-  queue_node_t *node = queue->head;
-  void* value = node->value;
-  queue->head = node->next;
+  void* value = pop_locked(queue);
 
   pthread_mutex_unlock_safe(&queue->mtx); /* unlock */
 
-  free(node);
+  return value;
+}
+
+/*
+ * Restituisce il valore del primo elemento della coda, estraendolo.
+ * Se la coda è vuota attende che venga inserito un nuovo elemento per al più
+ * 'timeout_ms' millisecondi.
+ * Restituisce NULL se allo scadere del tempo la coda è ancora vuota.
+ */
+void *queue_pop_wait(queue_t *queue, int timeout_ms) {
+  assert(queue != NULL);
+  assert(timeout_ms >= 0);
+  struct timespec deadline = deadline_ms(timeout_ms);
+
+  /* sezione critica */
+  pthread_mutex_lock_safe(&queue->mtx); /* lock */
+  while (queue_empty(queue)) {
+    if (pthread_cond_timedwait(&queue->not_empty_cond, &queue->mtx, &deadline) == ETIMEDOUT
+        && queue_empty(queue)) {
+      pthread_mutex_unlock_safe(&queue->mtx); /* unlock */
+      return NULL;
+    }
+  }
+
+  void *value = pop_locked(queue);
+  pthread_mutex_unlock_safe(&queue->mtx); /* unlock */
 
   return value;
 }
@@ -135,12 +431,14 @@ void* queue_top(queue_t *queue) {
   /* sezione critica */
   pthread_mutex_lock_safe(&queue->mtx); /* lock */
 
-  if (queue->head == NULL) { /* coda vuota */
+  if (queue_empty(queue)) { /* coda vuota */
     pthread_mutex_unlock_safe(&queue->mtx); /* unlock */
     return NULL;
   }
 
-  void *value = queue->head->value;
+  void *value = queue->ring != NULL
+    ? queue->ring[queue->first]
+    : queue->head->value;
   pthread_mutex_unlock_safe(&queue->mtx); /* unlock */
 
   return assert(value != NULL), value;
@@ -148,6 +446,9 @@ void* queue_top(queue_t *queue) {
 
 /*
  * Restituisce il numero di elementi contenuti nella coda.
+ * Il contatore è aggiornato da push e pop all'interno della sezione critica,
+ * quindi la lettura è O(1) e non acquisisce il lock della coda: il valore
+ * restituito può essere già superato da operazioni concorrenti.
  */
 size_t queue_size(queue_t *queue) {
   assert(queue != NULL);
@@ -155,30 +456,31 @@ size_t queue_size(queue_t *queue) {
     handle_error("queue_size: queue is NULL");
   }
 
-  /* sezione critica */
-  pthread_mutex_lock_safe(&queue->mtx); /* lock */
-
-  if (queue->head == NULL) {
-    pthread_mutex_unlock_safe(&queue->mtx); /* unlock */
-    return 0;
-  }
-
-  size_t n = 0;
-  queue_node_t *node = queue->head;
-  while (++n, (node = node->next) != NULL);
-
-  pthread_mutex_unlock_safe(&queue->mtx); /* unlock */
-  return n;
+  return atomic_load_explicit(&queue->size, memory_order_acquire);
 }
 
 /*
- * Libera la memoria allocata dalla coda chiamando ripetutamente queue_pop().
+ * Libera la memoria allocata dalla coda, compresi i nodi inutilizzati e il
+ * blocco preallocato. Nessun altro thread deve accedere alla coda durante la
+ * chiamata, quindi gli elementi rimasti sono scartati senza acquisire il lock.
  */
 void queue_free(queue_t *queue) {
   while (!queue_empty(queue)) {
-    queue_pop(queue);
+    take_locked(queue);
   }
   assert(queue->head == NULL);
+
+  /* libera i nodi allocati singolarmente */
+  queue_node_t *node = queue->free_nodes;
+  while (node != NULL) {
+    queue_node_t *next = node->next;
+    if (!node_in_slab(queue, node)) {
+      free(node);
+    }
+    node = next;
+  }
+  free(queue->slab);
+  free(queue->ring);
   free(queue);
 }
 
@@ -190,6 +492,15 @@ void queue_map(void (*f)(void*), queue_t *queue) {
 
   pthread_mutex_lock_safe(&queue->mtx); /* lock */
 
+  if (queue->ring != NULL) { /* coda limitata */
+    size_t size = queue_size(queue);
+    for (size_t i=0; i<size; i++) {
+      (*f)(queue->ring[(queue->first + i) % queue->capacity]);
+    }
+    pthread_mutex_unlock_safe(&queue->mtx); /* unlock */
+    return;
+  }
+
   if (queue->head == NULL) { /* coda vuota */
     pthread_mutex_unlock_safe(&queue->mtx); /* unlock */
     return;
@@ -204,17 +515,3 @@ void queue_map(void (*f)(void*), queue_t *queue) {
 
   pthread_mutex_unlock_safe(&queue->mtx); /* unlock */
 }
-
-/*
- * Attende che la coda non sia vuota.
- * Nota: al termine della chiamata, la funzione rilascia il lock, quindi non è
- * assicurato che vi siano ancora elementi all'interno della coda quando il
- * controllo ritorna al chiamante.
- */
-void queue_wait(queue_t *queue) {
-  pthread_mutex_lock_safe(&queue->mtx);
-  while (queue->head != NULL) { /* coda non vuota */
-    pthread_cond_wait(&queue->not_empty_cond, &queue->mtx);
-  }
-  pthread_mutex_unlock_safe(&queue->mtx);
-}
@@ -2,6 +2,7 @@
 #define QUEUE_H
 #include <stdlib.h> /* size_t */
 #include <pthread.h> /* pthread_mutex_t */
+#include <stdatomic.h> /* atomic_size_t */
 
 typedef struct queue_node {
   struct queue_node *next;
@@ -11,20 +12,35 @@ typedef struct queue_node {
 typedef struct queue {
   queue_node_t *head;
   queue_node_t *tail;
+  queue_node_t *free_nodes; /* nodi inutilizzati, riusati dalle push successive */
+  queue_node_t *slab;       /* blocco di nodi preallocato alla creazione */
+  size_t slab_size;         /* numero di nodi del blocco preallocato */
+  atomic_size_t size;       /* numero di elementi, leggibile senza lock */
+  /* modalità limitata: buffer circolare di dimensione fissa */
+  void **ring;              /* NULL se la coda non è limitata */
+  size_t capacity;          /* numero massimo di elementi */
+  size_t first;             /* indice del primo elemento nel buffer */
   pthread_mutex_t mtx;
   pthread_cond_t not_empty_cond;
-  //TODO: aggiungere cv not_full_cond
+  pthread_cond_t not_full_cond;
 }queue_t;
 
 
 queue_t *queue_create(void);
+queue_t *queue_create_sized(size_t prealloc);
+queue_t *queue_create_bounded(size_t capacity);
 int queue_empty(queue_t *queue);
+int queue_full(queue_t *queue);
 void queue_push(queue_t *queue, void *value);
+int queue_try_push(queue_t *queue, void *value);
+int queue_push_timed(queue_t *queue, void *value, int timeout_ms);
+size_t queue_push_batch(queue_t *queue, void **values, size_t n);
 void *queue_pop(queue_t *queue);
+void *queue_pop_wait(queue_t *queue, int timeout_ms);
+size_t queue_drain(queue_t *queue, void **values, size_t max);
 void *queue_top(queue_t *queue);
 size_t queue_size(queue_t *queue);
 void queue_free(queue_t *queue);
 void queue_map(void (*f)(void*), queue_t *queue);
-void queue_wait(queue_t *queue);
 
 #endif
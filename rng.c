@@ -0,0 +1,38 @@
+#include "rng.h"
+#include <stdlib.h> /* NULL */
+#include <assert.h>
+
+/* Seed globale dei generatori */
+static uint64_t seed = 1;
+
+/* Mescola i bit di x (finalizzatore di splitmix64) */
+static uint64_t mix(uint64_t x) {
+  x += 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+/*
+ * Imposta il seed globale, da cui sono derivati tutti i generatori
+ * inizializzati successivamente con rng_init().
+ * Deve essere chiamata prima della creazione dei thread della simulazione.
+ */
+void rng_set_seed(uint64_t s) {
+  seed = s;
+}
+
+/*
+ * Inizializza il generatore dell'entità 'id' del dominio 'dominio'
+ * (vedi enum rng_dominio) con un flusso indipendente da quello delle altre
+ * entità.
+ */
+void rng_init(rng_t *rng, int dominio, uint64_t id) {
+  assert(rng != NULL);
+  uint64_t stream = ((uint64_t)dominio << 48) ^ id;
+  rng->state = 0;
+  rng->inc = (stream << 1) | 1;
+  rng_next(rng);
+  rng->state += mix(seed ^ mix(stream));
+  rng_next(rng);
+}
@@ -0,0 +1,58 @@
+#ifndef RNG_H
+#define RNG_H
+#include <stdint.h>
+
+/*
+ * Generatore di numeri pseudo-casuali PCG32 (O'Neill, pcg-random.org).
+ * Ogni entità della simulazione (generatore dei clienti, clienti, cassieri,
+ * thread delle pool) possiede il proprio generatore, usato da un solo thread
+ * alla volta, quindi la generazione non richiede sincronizzazione.
+ * I generatori sono inizializzati dal seed globale (chiave SEED della
+ * configurazione, vedi rng_set_seed()) e da un flusso (stream) indipendente
+ * per ogni entità, determinato dal suo dominio e dal suo id: a parità di seed
+ * ogni entità riceve sempre la stessa sequenza di valori.
+ */
+
+/* Domini dei flussi: entità diverse con lo stesso id hanno flussi diversi */
+enum rng_dominio {
+  RNG_GENERATORE, /* generazione dei clienti */
+  RNG_CLIENTI,    /* scelte dei clienti (id del cliente) */
+  RNG_CASSIERI,   /* tempi di servizio dei cassieri (id del cassiere) */
+  RNG_THREADPOOL  /* scelta delle vittime del work-stealing */
+};
+
+typedef struct rng {
+  uint64_t state;
+  uint64_t inc; /* incremento dispari: identifica il flusso */
+}rng_t;
+
+void rng_set_seed(uint64_t seed);
+void rng_init(rng_t *rng, int dominio, uint64_t id);
+
+/* Restituisce un intero a 32 bit uniformemente distribuito */
+static inline uint32_t rng_next(rng_t *rng) {
+  uint64_t old = rng->state;
+  rng->state = old * 6364136223846793005ULL + rng->inc;
+  uint32_t xorshifted = (uint32_t)(((old >> 18u) ^ old) >> 27u);
+  uint32_t rot = (uint32_t)(old >> 59u);
+  return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+}
+
+/*
+ * Restituisce un intero uniformemente distribuito in [0, n), con n > 0.
+ * Metodo di Lemire: nel caso comune non effettua divisioni.
+ */
+static inline uint32_t rng_range(rng_t *rng, uint32_t n) {
+  uint64_t m = (uint64_t)rng_next(rng) * n;
+  uint32_t l = (uint32_t)m;
+  if (l < n) {
+    uint32_t soglia = -n % n;
+    while (l < soglia) {
+      m = (uint64_t)rng_next(rng) * n;
+      l = (uint32_t)m;
+    }
+  }
+  return (uint32_t)(m >> 32);
+}
+
+#endif
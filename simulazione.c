@@ -5,10 +5,15 @@
 #include "direttore.h"
 #include "queue.h"
 #include "threadpool.h"
+#include "coroutine.h"
 #include "defines.h"
 #include "logger.h"
+#include "virtuale.h"
+#include "stopwatch.h"
+#include "rng.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h> /* offsetof */
 #include <unistd.h>
 #include <time.h>
 #include <pthread.h>
@@ -18,10 +23,24 @@
 
 #define CLOSE_QUIT 1
 #define CLOSE_HUP 2
+/* Dimensione dello stack dei thread (o delle coroutine) cliente: i clienti
+ * trascorrono quasi tutto il tempo in attesa e non necessitano dello stack
+ * predefinito. */
+#define CLIENTE_STACK_SIZE (64*1024)
+/* Inattività oltre la quale un thread cliente della pool termina (ms) */
+#define CLIENTE_IDLE_TIMEOUT 1000
+
+/* Esecuzione dei clienti */
+enum {
+  CLIENTI_THREAD,    /* un job per cliente eseguito da un thread della pool */
+  CLIENTI_EVENTI,    /* clienti guidati dagli eventi (opzione -e) */
+  CLIENTI_COROUTINE  /* clienti eseguiti come coroutine (opzione -g) */
+};
 
 struct t_info {
   supermercato_t *supermercato;
   const config_t *config;
+  int modo; /* esecuzione dei clienti: CLIENTI_THREAD, _EVENTI o _COROUTINE */
 };
 
 static pthread_t create_thread;
@@ -43,14 +62,157 @@ static void stop_creazione_clienti(void) {
   }
 }
 
+/*
+ * Cliente ed esito del suo job: la memoria di un cliente uscito dal
+ * supermercato è riutilizzata per i clienti successivi, senza allocazioni.
+ */
+struct slot_cliente {
+  cliente_t cliente;
+  threadpool_future_t future; /* esito di cliente_worker() */
+  coroutine_t coroutine;      /* esecuzione come coroutine (CLIENTI_COROUTINE) */
+};
+
+/*
+ * Job cliente in corso ed esiti dei clienti già usciti dal supermercato,
+ * ottenuti dai valori restituiti da cliente_worker() oppure, se i clienti
+ * sono guidati dagli eventi o eseguiti come coroutine, comunicati da
+ * registra_uscita().
+ */
+struct esiti {
+  threadpool_t *tpool;           /* NULL per CLIENTI_COROUTINE */
+  coroutine_sched_t *sched;      /* scheduler delle coroutine cliente */
+  int modo;                      /* esecuzione dei clienti */
+  struct slot_cliente *slots;    /* C elementi, allocati alla creazione */
+  size_t num_slots;              /* numero di elementi di slots */
+  struct slot_cliente **pending; /* clienti i cui esiti non sono raccolti */
+  size_t num_pending;            /* numero di elementi di pending */
+  struct slot_cliente **liberi;  /* elementi di slots riutilizzabili */
+  size_t num_liberi;             /* numero di elementi di liberi */
+  size_t presenti;               /* clienti nel supermercato (eventi, coroutine) */
+  int terminati;                 /* clienti usciti dal supermercato */
+  int non_serviti;               /* clienti usciti per mancanza di casse */
+  pthread_mutex_t mtx;           /* sincronizza liberi, presenti e contatori */
+  pthread_cond_t uscita_cond;    /* segnalata all'uscita di un cliente (eventi, coroutine) */
+};
+
+/*
+ * Registra l'esito di un cliente guidato dagli eventi o eseguito come
+ * coroutine, uscito dal supermercato, e ne rende riutilizzabile l'elemento.
+ */
+static void registra_uscita(struct esiti *esiti, struct slot_cliente *slot, void *esito) {
+  destroy_cliente(&slot->cliente);
+
+  pthread_mutex_lock_safe(&esiti->mtx);
+  esiti->terminati++;
+  if (esito != (void*)0) {
+    esiti->non_serviti++;
+  }
+  esiti->liberi[esiti->num_liberi++] = slot;
+  esiti->presenti--;
+  pthread_cond_signal(&esiti->uscita_cond);
+  pthread_mutex_unlock_safe(&esiti->mtx);
+}
+
+/* Routine chiamata all'uscita di un cliente guidato dagli eventi */
+static void uscita_cliente(cliente_t *cliente, void *esito, void *arg) {
+  /* il cliente è il primo campo del proprio elemento */
+  registra_uscita((struct esiti*) arg, (struct slot_cliente*) cliente, esito);
+}
+
+/* Routine chiamata al termine della coroutine di un cliente */
+static void fine_coroutine(coroutine_t *co, void *esito, void *arg) {
+  struct slot_cliente *slot = (struct slot_cliente*)
+    ((char*)co - offsetof(struct slot_cliente, coroutine));
+  registra_uscita((struct esiti*) arg, slot, esito);
+}
+
 /*
  * Crea un nuovo cliente con al massimo p prodotti e con tempo di permanenza
- * di al più t millisecondi.
+ * di al più t millisecondi, utilizzando un elemento libero di esiti->slots,
+ * e lo fa entrare nel supermercato: il job del cliente è eseguito quando il
+ * cliente ha scelto i prodotti.
  */
-static cliente_t *generate_cliente(int p, int t, supermercato_t *s) {
-  int n = rand() % p; /* prodotti 0-20 */
-  int dwell = 10 + rand() % (t - 10); /* dwell time 10-t ms */
-  return create_cliente(dwell, n, s);
+static void generate_cliente(int p, int t, supermercato_t *s, struct esiti *esiti, rng_t *rng) {
+  int n = rng_range(rng, p); /* prodotti 0-20 */
+  int dwell = 10 + rng_range(rng, t - 10); /* dwell time 10-t ms */
+
+  pthread_mutex_lock_safe(&esiti->mtx);
+  assert(esiti->num_liberi > 0);
+  struct slot_cliente *slot = esiti->liberi[--esiti->num_liberi];
+  if (esiti->modo != CLIENTI_THREAD) {
+    esiti->presenti++;
+  }
+  pthread_mutex_unlock_safe(&esiti->mtx);
+
+  init_cliente(&slot->cliente, dwell, n, s);
+  if (esiti->modo == CLIENTI_EVENTI) {
+    start_cliente_eventi(&slot->cliente, esiti->tpool, uscita_cliente, (void*)esiti);
+    return;
+  }
+  if (esiti->modo == CLIENTI_COROUTINE) {
+    coroutine_start(esiti->sched, &slot->coroutine,
+        cliente_coroutine, (void*) &slot->cliente,
+        fine_coroutine, (void*) esiti);
+    return;
+  }
+
+  threadpool_job_init(&slot->cliente.job,
+      cliente_worker, /* job */
+      (void*) &slot->cliente,  /* argomento del job */
+      (void (*)(void*)) destroy_cliente); /* cleanup routine */
+  threadpool_job_set_future(&slot->cliente.job, &slot->future);
+  esiti->pending[esiti->num_pending++] = slot;
+  threadpool_add_delayed(esiti->tpool, &slot->cliente.job, stopwatch_real_ms(dwell));
+}
+
+/*
+ * Raccoglie gli esiti dei job cliente terminati, rendendone riutilizzabili
+ * gli elementi.
+ */
+static void raccogli_esiti(struct esiti *esiti) {
+  size_t i = 0;
+  pthread_mutex_lock_safe(&esiti->mtx);
+  while (i < esiti->num_pending) {
+    struct slot_cliente *slot = esiti->pending[i];
+    threadpool_future_t *future = &slot->future;
+    if (!threadpool_future_done(future)) {
+      i++;
+      continue;
+    }
+
+    /* i job annullati non sono mai stati eseguiti */
+    if (!threadpool_future_cancelled(future)) {
+      esiti->terminati++;
+      if (threadpool_future_result(future) != (void*)0) {
+        esiti->non_serviti++;
+      }
+    }
+    esiti->liberi[esiti->num_liberi++] = slot;
+    /* l'ultimo elemento prende il posto di quello rimosso */
+    esiti->pending[i] = esiti->pending[--esiti->num_pending];
+  }
+  pthread_mutex_unlock_safe(&esiti->mtx);
+}
+
+/*
+ * Restituisce il numero di clienti all'interno del supermercato: i job
+ * cliente sottomessi alla pool oppure, se i clienti sono guidati dagli
+ * eventi o eseguiti come coroutine, i clienti non ancora usciti.
+ * Deve essere chiamata con il mutex restituito da mutex_uscite() acquisito.
+ */
+static size_t clienti_presenti(const struct esiti *esiti) {
+  return esiti->modo != CLIENTI_THREAD ? esiti->presenti : esiti->tpool->job_count;
+}
+
+/*
+ * Mutex e condizione segnalata all'uscita di un cliente dal supermercato.
+ */
+static pthread_mutex_t *mutex_uscite(struct esiti *esiti) {
+  return esiti->modo != CLIENTI_THREAD ? &esiti->mtx : &esiti->tpool->mtx;
+}
+
+static pthread_cond_t *cond_uscite(struct esiti *esiti) {
+  return esiti->modo != CLIENTI_THREAD ? &esiti->uscita_cond : &esiti->tpool->not_full_cond;
 }
 
 /*
@@ -58,19 +220,53 @@ static cliente_t *generate_cliente(int p, int t, supermercato_t *s) {
  * terminare.
  * Se è stato ricevuto un segnale SIGHUP, attende la terminazione di tutti i
  * job cliente attualmente in sospeso nella threadpool prima di liberare la
- * memoria.
+ * memoria. Al termine scrive sul file di log gli esiti dei clienti.
+ * I clienti guidati dagli eventi o eseguiti come coroutine sono sempre
+ * attesi: dopo un segnale SIGQUIT le casse sono chiuse e i clienti escono non
+ * appena hanno scelto i prodotti.
  */
 static void cleanup(void* arg) {
   assert(arg != NULL);
   assert(quit != 0);
-  threadpool_t *tpool = (threadpool_t*) arg;
+  struct esiti *esiti = (struct esiti*) arg;
 
-  /* Se è stato ricevuto un segnale SIGHUP: attende la terminazione dei clienti */
-  if (quit == CLOSE_HUP) {
-    threadpool_wait(tpool, 0);
+  if (esiti->modo != CLIENTI_THREAD) {
+    pthread_mutex_lock_safe(&esiti->mtx);
+    while (esiti->presenti > 0) {
+      pthread_cond_wait(&esiti->uscita_cond, &esiti->mtx);
+    }
+    pthread_mutex_unlock_safe(&esiti->mtx);
+  }
+  else {
+    /* Con SIGQUIT i clienti che stanno ancora scegliendo i prodotti escono
+     * subito: i loro job ritardati sono eseguiti senza attendere la scadenza
+     * e, trovando il supermercato chiuso, registrano comunque l'uscita. */
+    if (quit == CLOSE_QUIT) {
+      threadpool_flush_delayed(esiti->tpool);
+    }
+    threadpool_wait(esiti->tpool, 0);
   }
 
-  threadpool_free(tpool);
+  /* dopo threadpool_free() tutti i future sono terminati o annullati */
+  if (esiti->modo == CLIENTI_COROUTINE) {
+    coroutine_sched_free(esiti->sched);
+  }
+  else {
+    threadpool_free(esiti->tpool);
+  }
+  raccogli_esiti(esiti);
+  assert(esiti->num_pending == 0);
+  for (size_t i=0; i<esiti->num_slots; i++) {
+    threadpool_future_destroy(&esiti->slots[i].future);
+  }
+  free(esiti->slots);
+  free(esiti->pending);
+  free(esiti->liberi);
+  pthread_mutex_destroy(&esiti->mtx);
+  pthread_cond_destroy(&esiti->uscita_cond);
+
+  log_write("SUPERMERCATO: clienti terminati = %d\n", esiti->terminati);
+  log_write("SUPERMERCATO: clienti non serviti = %d\n", esiti->non_serviti);
 }
 
 /*
@@ -96,51 +292,106 @@ static void *creazione_clienti(void* arg) {
   int e = config->params[E];
   assert(max_clienti > 0);
 
-  cliente_t *cliente;
-  threadpool_t *tpool = threadpool_create(max_clienti);
-  threadpool_job_t *tjob;
+  threadpool_t *tpool = NULL;
+  coroutine_sched_t *sched = NULL;
+  threadpool_attr_t tattr;
+  long cpu = sysconf(_SC_NPROCESSORS_ONLN);
+  if (info->modo == CLIENTI_COROUTINE) {
+    /* Clienti eseguiti come coroutine: un thread per processore esegue i
+     * clienti, che si sospendono nei punti di attesa con stack ridotti e
+     * riutilizzati. */
+    sched = coroutine_sched_create(cpu > 0 ? (size_t)cpu : 1, CLIENTE_STACK_SIZE);
+  }
+  else if (info->modo == CLIENTI_EVENTI) {
+    /* Clienti guidati dagli eventi: un numero fisso di thread, pari ai
+     * processori disponibili, esegue gli eventi di tutti i clienti. Il numero
+     * di job in attesa non è limitato (vedi start_cliente_eventi()). */
+    threadpool_attr_init(&tattr, cpu > 0 ? (size_t)cpu : 1);
+  }
+  else {
+    /* Un job per ogni cliente nel supermercato: la coda dei job in attesa non
+     * supera mai C elementi e viene allocata interamente alla creazione.
+     * La pool parte con E thread e cresce fino a C soltanto quando i clienti
+     * presenti lo richiedono: i clienti che stanno scegliendo i prodotti non
+     * occupano alcun thread (threadpool_add_delayed()). */
+    threadpool_attr_init(&tattr, max_clienti);
+    tattr.min_size = (size_t)e < max_clienti ? (size_t)e : max_clienti;
+    tattr.idle_timeout_ms = CLIENTE_IDLE_TIMEOUT;
+    tattr.max_jobs = max_clienti;
+  }
+  if (sched == NULL) {
+    tattr.stack_size = CLIENTE_STACK_SIZE;
+    /* code dei job per thread: le sottomissioni non si contendono un unico lock */
+    tattr.work_stealing = 1;
+    tpool = threadpool_create_attr(&tattr);
+  }
+  /* I clienti nel supermercato non superano mai C: gli esiti dei clienti
+   * terminati sono raccolti prima di ogni nuovo ingresso e i loro elementi
+   * riutilizzati, quindi i nuovi ingressi non effettuano allocazioni. */
+  struct esiti esiti;
+  esiti.tpool = tpool;
+  esiti.sched = sched;
+  esiti.modo = info->modo;
+  esiti.num_slots = max_clienti;
+  esiti.num_pending = 0;
+  esiti.num_liberi = 0;
+  esiti.presenti = 0;
+  esiti.terminati = 0;
+  esiti.non_serviti = 0;
+  esiti.slots = (struct slot_cliente*) malloc(sizeof(struct slot_cliente)*max_clienti);
+  esiti.pending = (struct slot_cliente**) malloc(sizeof(struct slot_cliente*)*max_clienti);
+  esiti.liberi = (struct slot_cliente**) malloc(sizeof(struct slot_cliente*)*max_clienti);
+  if (esiti.slots == NULL || esiti.pending == NULL || esiti.liberi == NULL) {
+    handle_error("creazione_clienti malloc");
+  }
+  for (size_t i=0; i<max_clienti; i++) {
+    threadpool_future_init(&esiti.slots[i].future);
+    esiti.liberi[esiti.num_liberi++] = &esiti.slots[i];
+  }
+  pthread_mutex_init_ec(&esiti.mtx, NULL);
+  pthread_cond_init(&esiti.uscita_cond, NULL);
+  pthread_mutex_t *uscite_mtx = mutex_uscite(&esiti);
+  pthread_cond_t *uscite_cond = cond_uscite(&esiti);
 
   /* Riabilita la cancellazione del thread */
   pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
 
+  /* Generatore dei clienti: a parità di SEED la sequenza dei clienti è
+   * la stessa in ogni modalità, anche a tempo virtuale */
+  rng_t rng;
+  rng_init(&rng, RNG_GENERATORE, 0);
+
   /* Creazione iniziale di C clienti */
   for (uint i=0; i<max_clienti; i++) {
-    /* crea un nuovo cliente */
-    cliente = generate_cliente(p, t, supermercato);
-    /* sottomette il job cliente alla threadpool */
-    tjob = threadpool_job_create(
-        cliente_worker, /* job */
-        (void*) cliente,  /* argomento del job */
-        (void (*)(void*)) free_cliente); /* cleanup routine */
-    threadpool_add(tpool, tjob);
+    generate_cliente(p, t, supermercato, &esiti, &rng);
   }
 
   while (quit == 0) {
     /* Attesa condizionata sul numero di clienti all'interno del supermercato */
-    pthread_mutex_lock_safe(&tpool->mtx);
-    while (tpool->job_count > max_clienti - e && quit == 0) {
+    pthread_mutex_lock_safe(uscite_mtx);
+    while (clienti_presenti(&esiti) > max_clienti - e && quit == 0) {
       /* Registra la routine di pulizia chiamata a seguito di pthread_cancel().
        * Nota: L'ordine di esecuzione degli handler di cleanup è inverso rispetto
        * all'ordine di inserimento (ordine LIFO). */
-      pthread_cleanup_push(cleanup, (void*) tpool);
+      pthread_cleanup_push(cleanup, (void*) &esiti);
 
       /* pthread_cancel() ha effetto solo se il thread al momento si trova in un
        * cancellation point. L'unico cancellation point del thread è la funziona
        * pthread_cond_wait(), la quale a seguito della chiamata a pthread_cancel()
-       * risveglia il thread con il mutex tpool->mtx acquisito e passa il controllo
+       * risveglia il thread con il mutex uscite_mtx acquisito e passa il controllo
        * all'ultimo cleanup handler inserito. Di conseguenza è necessario
        * rilasciare il mutex inserendo come routine di cleanup il wrapper
-       * pthread_mutex_unlock_safe() con argomento tpool->mtx.
+       * pthread_mutex_unlock_safe() con argomento uscite_mtx.
        */
       pthread_cleanup_push((void (*)(void*)) pthread_mutex_unlock_safe,
-          (void*) &tpool->mtx);
+          (void*) uscite_mtx);
 
-      pthread_cond_wait(&tpool->not_full_cond, &tpool->mtx); /* cancellation point */
+      pthread_cond_wait(uscite_cond, uscite_mtx); /* cancellation point */
 
-      pthread_cleanup_pop(0); /* unlock tpool->mtx: non eseguire */
+      pthread_cleanup_pop(0); /* unlock uscite_mtx: non eseguire */
       pthread_cleanup_pop(0); /* cleanup:           non eseguire*/
     }
-    pthread_mutex_unlock_safe(&tpool->mtx);
+    pthread_mutex_unlock_safe(uscite_mtx);
 
     /* Termina l'esecuzione se è stata segnalata la chiusura */
     if (quit != 0) {
@@ -148,15 +399,9 @@ static void *creazione_clienti(void* arg) {
     }
 
     /* Creazione scaglionata di E clienti per volta */
+    raccogli_esiti(&esiti);
     for (int i=0; i<e; i++) {
-      /* crea un nuovo cliente */
-      cliente = generate_cliente(p, t, supermercato);
-      /* sottomette il job cliente alla threadpool */
-      tjob = threadpool_job_create(
-          cliente_worker, /* job */
-          (void*) cliente,  /* argomento del job */
-          (void (*)(void*)) free_cliente); /* cleanup routine */
-      threadpool_add(tpool, tjob);
+      generate_cliente(p, t, supermercato, &esiti, &rng);
     }
   }
 
@@ -165,13 +410,9 @@ static void *creazione_clienti(void* arg) {
    */
   pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
 
-  /* Se è stato ricevuto un segnale SIGHUP: attende la terminazione dei clienti */
-  assert(quit != 0);
-  if (quit == CLOSE_HUP) {
-    threadpool_wait(tpool, 0);
-  }
-  /* Deallocazione risorse usate dalla threadpool */
-  threadpool_free(tpool);
+  /* Attesa dei clienti (SIGHUP) e deallocazione risorse usate dalla
+   * threadpool */
+  cleanup((void*) &esiti);
 
   return (void*)0;
 }
@@ -189,20 +430,46 @@ static void signal_handler(int signum) {
 int main(int argc, char *argv[]) {
 
   const char *config_file = "config.txt"; /* default path */
+  int modo = CLIENTI_THREAD;
+  long virtuale = 0; /* durata della simulazione a tempo virtuale (secondi) */
+  char *end;
   int opt;
 
   /* Parsing argomenti linea di comando */
-  while ((opt = getopt(argc, argv, "c:")) != -1) {
+  while ((opt = getopt(argc, argv, "c:egv:")) != -1) {
     switch(opt) {
       case 'c':
         config_file = optarg;
         break;
+      case 'e': /* clienti guidati dagli eventi */
+        modo = CLIENTI_EVENTI;
+        break;
+      case 'g': /* clienti eseguiti come coroutine */
+        modo = CLIENTI_COROUTINE;
+        break;
+      case 'v': /* simulazione a tempo virtuale di optarg secondi */
+        virtuale = strtol(optarg, &end, 10);
+        if (*optarg == '\0' || *end != '\0' || virtuale <= 0) {
+          fprintf(stderr, "Durata non valida: %s\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
       default:
-        fprintf(stderr, "Uso: %s [-c config_file]\n", argv[0]);
+        fprintf(stderr, "Uso: %s [-c config_file] [-e | -g] [-v secondi]\n", argv[0]);
         exit(EXIT_FAILURE);
     }
   }
 
+  /* Simulazione a tempo virtuale: non utilizza thread nè segnali */
+  if (virtuale > 0) {
+    config_t config;
+    parse_config(config_file, &config);
+    rng_set_seed(config.SEED);
+    simulazione_virtuale(&config, (unsigned long long)virtuale*1000);
+    free_config(&config);
+    printf("Supermercato chiuso \n");
+    exit(EXIT_SUCCESS);
+  }
 
   /* Registrazione handler dei segnali */
   struct sigaction sa;
@@ -222,11 +489,16 @@ int main(int argc, char *argv[]) {
   /* Parsing del file di configurazione */
   config_t config;
   parse_config(config_file, &config);
+  /* I tempi della configurazione e del file di log sono simulati: le attese
+   * reali sono scalate di un fattore config.SPEED */
+  stopwatch_set_speed(config.SPEED);
+  /* Tutti i generatori casuali sono derivati da config.SEED */
+  rng_set_seed(config.SEED);
 
   /* Crea il supermercato */
   supermercato_t *s = create_supermercato(&config);
   init_direttore(s, config.params[S1], config.params[S2]);
-  struct t_info info = { s, &config };
+  struct t_info info = { s, &config, modo };
 
   /* Crea il thread di creazione dei clienti */
   pthread_create(&create_thread, NULL, creazione_clienti, (void*)&info);
@@ -2,12 +2,11 @@
 #include "defines.h"
 #include <time.h>
 #include <stdlib.h>
+#include <assert.h>
 
-typedef struct stopwatch {
-  struct timespec start;
-  struct timespec end;
-  int started;
-}stopwatch_t;
+/* Fattore di scala del tempo simulato rispetto al tempo reale: impostato
+ * prima della creazione dei thread e successivamente soltanto letto. */
+static double speed = 1;
 
 /*
  * Calcola la differenza in millisecondi tra le due misurazioni di uno stopwatch.
@@ -28,6 +27,18 @@ stopwatch_t *stopwatch_create(int start) {
   if (stopwatch == NULL) {
     handle_error("stopwatch_create: malloc");
   }
+  stopwatch_init(stopwatch, start);
+  return stopwatch;
+}
+
+/*
+ * Inizializza uno stopwatch la cui memoria è gestita dal chiamante, con gli
+ * stessi valori di 'start' di stopwatch_create().
+ */
+void stopwatch_init(stopwatch_t *stopwatch, int start) {
+  if (stopwatch == NULL) {
+    handle_error("stopwatch_init: NULL stopwatch");
+  }
   if (start == STOPWATCH_STARTING) {
     stopwatch->started = 1;
     clock_gettime(CLOCK_REALTIME, &stopwatch->start); /* Inizializza lo stopwatch */
@@ -35,12 +46,10 @@ stopwatch_t *stopwatch_create(int start) {
   else {
     stopwatch->started = 0;
   }
-
-  return stopwatch;
 }
 
 /*
- * Fa partire lo stopwatch il quale inizia a misurare il tempo reale (wall time)
+ * Fa partire lo stopwatch il quale inizia a misurare il tempo simulato
  * trascorso a partire dal momento della chiamata.
  * Se lo stopwatch era già stato avviato, la vecchia misurazione viene sovrascritta.
  */
@@ -66,7 +75,7 @@ int stopwatch_end(stopwatch_t *stopwatch) {
   }
   stopwatch->started = 0;
   clock_gettime(CLOCK_REALTIME, &stopwatch->end);
-  return diff_ms(stopwatch);
+  return (int)(diff_ms(stopwatch)*speed + 0.5);
 }
 
 /*
@@ -75,3 +84,26 @@ int stopwatch_end(stopwatch_t *stopwatch) {
 void stopwatch_free(stopwatch_t *stopwatch) {
   free(stopwatch);
 }
+
+/*
+ * Imposta il fattore di scala del tempo: con speed = 10 un millisecondo reale
+ * corrisponde a 10 millisecondi simulati. Deve essere chiamata prima di
+ * avviare i thread che misurano o attendono il tempo simulato.
+ */
+void stopwatch_set_speed(double s) {
+  assert(s > 0);
+  speed = s;
+}
+
+/*
+ * Converte 'ms' millisecondi simulati in millisecondi reali, da utilizzare
+ * per le attese (nanosleep, attese con timeout). Un intervallo positivo non
+ * è mai convertito in un'attesa nulla.
+ */
+int stopwatch_real_ms(int ms) {
+  if (ms <= 0) {
+    return ms;
+  }
+  int real = (int)(ms/speed + 0.5);
+  return real > 0 ? real : 1;
+}
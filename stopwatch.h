@@ -4,11 +4,27 @@
 #define STOPWATCH_STOPPED 0
 #define STOPWATCH_STARTING 1
 
-typedef struct stopwatch stopwatch_t;
+#include <time.h>
+
+/*
+ * Cronometro che misura il tempo simulato in millisecondi: il tempo reale
+ * (wall time) trascorso moltiplicato per il fattore di scala impostato con
+ * stopwatch_set_speed() (1 di default).
+ * Uno stopwatch può essere allocato con stopwatch_create() oppure contenuto
+ * in un'altra struttura e inizializzato con stopwatch_init().
+ */
+typedef struct stopwatch {
+  struct timespec start;
+  struct timespec end;
+  int started;
+}stopwatch_t;
 
 struct stopwatch *stopwatch_create(int start);
+void stopwatch_init(struct stopwatch *stopwatch, int start);
 void stopwatch_start(struct stopwatch *stopwatch);
 int stopwatch_end(struct stopwatch *stopwatch);
 void stopwatch_free(struct stopwatch *stopwatch);
+void stopwatch_set_speed(double speed);
+int stopwatch_real_ms(int ms);
 
 #endif
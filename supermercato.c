@@ -6,6 +6,30 @@
 #include <stdio.h>
 #include <assert.h>
 
+/*
+ * Inserisce la cassa i-esima nell'indice delle casse aperte.
+ * Deve essere chiamata con cassieri_mtx acquisito.
+ */
+static void aggiungi_aperta(supermercato_t *supermercato, unsigned int i) {
+  assert(supermercato->num_casse < supermercato->max_casse);
+  supermercato->posizioni[i] = supermercato->num_casse;
+  supermercato->aperte[supermercato->num_casse++] = &supermercato->cassieri[i];
+}
+
+/*
+ * Rimuove in tempo costante la cassa i-esima dall'indice delle casse aperte:
+ * l'ultima cassa dell'indice ne prende il posto.
+ * Deve essere chiamata con cassieri_mtx acquisito.
+ */
+static void rimuovi_aperta(supermercato_t *supermercato, unsigned int i) {
+  assert(supermercato->num_casse > 0);
+  unsigned int pos = supermercato->posizioni[i];
+  assert(supermercato->aperte[pos] == &supermercato->cassieri[i]);
+  cassiere_t *ultima = supermercato->aperte[--supermercato->num_casse];
+  supermercato->aperte[pos] = ultima;
+  supermercato->posizioni[ultima - supermercato->cassieri] = pos;
+}
+
 /*
  * Crea il Supermercato allocando `max_casse` cassieri, di cui `num_casse` 
  * vengono attivati su thread separati.
@@ -36,7 +60,11 @@ supermercato_t *create_supermercato(const config_t *config) {
     handle_error("malloc supermercato");
   }
   s->max_casse = max_casse;
-  s->num_casse = num_casse;
+  s->num_casse = 0; /* incrementato all'apertura delle casse iniziali */
+  s->chiuso = 0;
+  s->routing = config->ROUTING;
+  s->max_cambi = config->JOCKEY;
+  s->soglia_cambi = config->JOCKEY_SOGLIA;
 
   /* Inizializzazione mutex cassieri */
   pthread_mutex_init_ec(&s->cassieri_mtx, NULL);
@@ -46,17 +74,29 @@ supermercato_t *create_supermercato(const config_t *config) {
   if (s->cassieri == NULL) {
     handle_error("malloc cassieri");
   }
+  s->aperte = (cassiere_t**) malloc(sizeof(cassiere_t*)*max_casse);
+  s->posizioni = (unsigned int*) malloc(sizeof(unsigned int)*max_casse);
+  if (s->aperte == NULL || s->posizioni == NULL) {
+    handle_error("malloc indice casse");
+  }
 
-  /* Inizializzazione e apertura iniziale casse:
-   * non è necessario ottenere il lock dei cassieri in quanto al momento
-   * nessuno (oltre a supermercato) ne detiene i riferimenti.
-   */
+  /* Inizializzazione casse: non è necessario ottenere il lock dei cassieri
+   * in quanto al momento nessuno (oltre a supermercato) ne detiene i
+   * riferimenti. */
   for (int i=0; i<max_casse; i++) {
     init_cassiere(&s->cassieri[i], tempo, config->params[S]);
-    if (i < num_casse) {
-      open_cassa(&s->cassieri[i]);
-    }
+    s->cassieri[i].supermercato = s;
+  }
+
+  /* Apertura iniziale casse: i cassieri aperti accedono all'indice delle
+   * casse aperte (vedi cambia_coda_supermercato()), quindi il lock è
+   * necessario da qui in poi. */
+  pthread_mutex_lock_safe(&s->cassieri_mtx);
+  for (int i=0; i<num_casse; i++) {
+    open_cassa(&s->cassieri[i], NULL, NULL);
+    aggiungi_aperta(s, i);
   }
+  pthread_mutex_unlock_safe(&s->cassieri_mtx);
 
   return s;
 }
@@ -71,15 +111,14 @@ void close_supermercato(supermercato_t *supermercato) {
   assert((int)supermercato->num_casse >= 0);
 
   pthread_mutex_lock_safe(&supermercato->cassieri_mtx);
-  /* Informa tutti i cassieri di chiudere le casse */
-  for (uint i=0; i<supermercato->max_casse; i++) {
-    if (is_cassa_active(&supermercato->cassieri[i])
-        && !is_cassa_closing(&supermercato->cassieri[i])) {
-      close_cassa(&supermercato->cassieri[i]);
-      supermercato->num_casse--;
-      assert((int)supermercato->num_casse >= 0);
-    }
+  /* Da questo momento il direttore non può riaprire le casse, quindi l'indice
+   * resta vuoto e le attese seguenti terminano */
+  supermercato->chiuso = 1;
+  /* Informa tutti i cassieri aperti di chiudere le casse */
+  for (uint i=0; i<supermercato->num_casse; i++) {
+    close_cassa(supermercato->aperte[i], NULL, NULL);
   }
+  supermercato->num_casse = 0;
   pthread_mutex_unlock_safe(&supermercato->cassieri_mtx);
 
   /* 
@@ -91,27 +130,18 @@ void close_supermercato(supermercato_t *supermercato) {
     wait_cassa(&supermercato->cassieri[i]);
   }
 
+  /* Le casse non possono più essere riaperte: termina i thread dei cassieri */
+  for (uint i=0; i<supermercato->max_casse; i++) {
+    terminate_cassa(&supermercato->cassieri[i]);
+  }
+
   /*
    * Logging statistiche supermercato
    */
   int totale_prodotti = 0;
   int totale_serviti = 0;
   for (uint i=0; i<supermercato->max_casse; i++) {
-    log_write("CASSA %d: prodotti venduti = %d\n",
-        cassa_id(&supermercato->cassieri[i]),
-        supermercato->cassieri[i].prodotti_venduti);
-    log_write("CASSA %d: clienti serviti = %d\n",
-        cassa_id(&supermercato->cassieri[i]),
-        supermercato->cassieri[i].clienti_serviti);
-    log_write("CASSA %d: numero chiusure = %d\n",
-        cassa_id(&supermercato->cassieri[i]),
-        supermercato->cassieri[i].numero_chiusure);
-    log_write("CASSA %d: tempo totale = %.3f\n",
-        cassa_id(&supermercato->cassieri[i]),
-        (double)supermercato->cassieri[i].tempo_totale/1000);
-    log_write("CASSA %d: tempo medio servizio = %.3f\n",
-        cassa_id(&supermercato->cassieri[i]),
-        (double)supermercato->cassieri[i].tempo_medio/1000);
+    log_cassiere(&supermercato->cassieri[i]);
     totale_prodotti += supermercato->cassieri[i].prodotti_venduti;
     totale_serviti += supermercato->cassieri[i].clienti_serviti;
   }
@@ -128,24 +158,27 @@ void free_supermercato(supermercato_t *supermercato) {
   assert(supermercato != NULL);
   for (uint i=0; i<supermercato->max_casse; i++) {
     /* Libera la memoria delle code clienti */
-    queue_free(supermercato->cassieri[i].clienti);
+    ilist_free(supermercato->cassieri[i].clienti);
   }
   log_close();
+  free(supermercato->aperte);
+  free(supermercato->posizioni);
   free(supermercato->cassieri);
   free(supermercato);
 }
 
 
 /*
- * Seleziona una cassa in modo casuale tra quelle aperte e vi accoda il cliente.
- * Il parametro seed viene utilizzato per determinare in modo casuale la cassa.
+ * Seleziona una cassa tra quelle aperte, secondo la politica di routing
+ * configurata (vedi scegli_cassa()), e vi accoda il cliente.
+ * Il generatore rng viene utilizzato per le scelte casuali della politica.
  *
  * Restituisce: un puntatore al cassiere a cui il cliente viene accodato.
  *              Se non ci sono casse aperte, restituisce NULL.
  */
-cassiere_t* place_cliente(cliente_t *cliente, supermercato_t *supermercato, unsigned int *seed) {
+cassiere_t* place_cliente(cliente_t *cliente, supermercato_t *supermercato, rng_t *rng) {
   assert(cliente != NULL && supermercato != NULL);
-  assert(seed != NULL);
+  assert(rng != NULL);
 
   pthread_mutex_lock_safe(&supermercato->cassieri_mtx);
 
@@ -154,45 +187,198 @@ cassiere_t* place_cliente(cliente_t *cliente, supermercato_t *supermercato, unsi
     return NULL;
   }
 
-  cassiere_t *cassieri = supermercato->cassieri;
-  cassiere_t *scelta = NULL;
+  /* sceglie una delle casse aperte secondo la politica configurata */
+  cassiere_t *scelta = scegli_cassa(supermercato->aperte, supermercato->num_casse,
+      supermercato->routing, rng);
 
-  /* numero casuale tra 0 e num_casse - 1: se c'è solo una cassa attiva r = 0 */
-  unsigned int attive = 0;
+  /* dal file cassiere.c */
+  add_cliente(scelta, cliente);
+
+  pthread_mutex_unlock_safe(&supermercato->cassieri_mtx);
+
+  return scelta;
+}
+
+
+/*
+ * Sceglie una cassa tra le 'n' casse 'casse' (n > 0) secondo la politica
+ * 'routing' (vedi enum routing_policy).
+ * Le lunghezze delle code e il lavoro atteso sono letti senza acquisire i
+ * lock delle code: la scelta si basa su valori che possono essere
+ * momentaneamente non aggiornati, ma non blocca mai i cassieri.
+ * Le scansioni iniziano da una posizione casuale, così che le casse con lo
+ * stesso carico siano scelte con uguale probabilità.
+ *
+ * Restituisce: il puntatore alla cassa scelta.
+ */
+cassiere_t *scegli_cassa(cassiere_t *const *casse, unsigned int n, int routing, rng_t *rng) {
+  assert(casse != NULL && n > 0 && rng != NULL);
+
+  /* numero casuale tra 0 e n - 1: se c'è solo una cassa attiva r = 0 */
   unsigned int r = 0;
-  if (supermercato->num_casse > 1) {
-    r = rand_r(seed) % supermercato->num_casse; 
+  if (n > 1) {
+    r = rng_range(rng, n);
   }
 
-  /* trova la r-esima cassa aperta */
-  for (uint i=0; i<supermercato->max_casse && attive <= r; i++) {
-    assert(attive < supermercato->num_casse);
-    assert(scelta == NULL);
-    if (is_cassa_active(&cassieri[i]) 
-        && !is_cassa_closing(&cassieri[i])
-        && attive++ == r) {
-      scelta = &cassieri[i];
+  cassiere_t *scelta = casse[r];
+  switch (routing) {
+    case ROUTING_JSQ: {
+      size_t minima = ilist_size(scelta->clienti);
+      for (unsigned int i=1; i<n && minima > 0; i++) {
+        cassiere_t *cassa = casse[(r + i) % n];
+        size_t lunghezza = ilist_size(cassa->clienti);
+        if (lunghezza < minima) {
+          scelta = cassa;
+          minima = lunghezza;
+        }
+      }
+      break;
+    }
+    case ROUTING_P2C:
+      if (n > 1) {
+        /* seconda cassa casuale, diversa dalla prima */
+        unsigned int r2 = rng_range(rng, n - 1);
+        cassiere_t *altra = casse[r2 >= r ? r2 + 1 : r2];
+        if (ilist_size(altra->clienti) < ilist_size(scelta->clienti)) {
+          scelta = altra;
+        }
+      }
+      break;
+    case ROUTING_LEW: {
+      int minimo = lavoro_atteso(scelta);
+      for (unsigned int i=1; i<n && minimo > 0; i++) {
+        cassiere_t *cassa = casse[(r + i) % n];
+        int lavoro = lavoro_atteso(cassa);
+        if (lavoro < minimo) {
+          scelta = cassa;
+          minimo = lavoro;
+        }
+      }
+      break;
     }
+    default: /* ROUTING_RANDOM */
+      assert(routing == ROUTING_RANDOM);
+      break;
   }
 
-  assert(scelta != NULL); /* deve esserci almeno una cassa aperta */
-  assert(attive == r + 1); /* le casse attive visitate in sequenza sono r - 1 */
+  return scelta;
+}
 
-  /* dal file cassiere.c */
-  add_cliente(scelta, cliente);
+/*
+ * Politica di jockeying, comune alla simulazione in tempo reale e a quella a
+ * tempo virtuale: restituisce la cassa diversa da 'esclusa' con la coda più
+ * corta tra le 'n' casse 'casse', e la lunghezza della sua coda in *minima;
+ * NULL se non ce ne sono. Come in scegli_cassa(), le lunghezze sono lette
+ * senza acquisire i lock delle code.
+ */
+cassiere_t *coda_piu_corta(cassiere_t *const *casse, unsigned int n,
+    const cassiere_t *esclusa, size_t *minima) {
+  assert(casse != NULL || n == 0);
+  assert(minima != NULL);
+  cassiere_t *scelta = NULL;
+  for (unsigned int i=0; i<n; i++) {
+    size_t lunghezza = ilist_size(casse[i]->clienti);
+    if (casse[i] != esclusa && (scelta == NULL || lunghezza < *minima)) {
+      scelta = casse[i];
+      *minima = lunghezza;
+    }
+  }
+  return scelta;
+}
+
+/*
+ * Politica di jockeying (vedi coda_piu_corta()): determina se un cliente che
+ * ha già cambiato coda 'cambi' volte, preceduto da 'posizione' clienti, deve
+ * passare a una coda di lunghezza 'lunghezza'. Il cliente si sposta se non ha
+ * raggiunto il massimo di 'max_cambi' cambi volontari e la nuova coda ha
+ * almeno 'soglia' clienti in meno di quelli che lo precedono.
+ */
+int cambio_conveniente(unsigned int cambi, unsigned int max_cambi,
+    size_t posizione, size_t lunghezza, unsigned int soglia) {
+  return cambi < max_cambi && lunghezza + soglia <= posizione;
+}
+
+/*
+ * Jockeying: ogni cliente in coda a 'cassa' rivaluta la propria posizione e
+ * passa alla coda più corta tra le altre casse aperte, secondo la politica di
+ * cambio_conveniente().
+ * La coda è visitata dalla testa: la posizione di ogni cliente tiene conto
+ * dei clienti che lo precedevano e si sono spostati.
+ * La visita non detiene il lock dei cassieri, acquisito soltanto per scegliere
+ * la coda di destinazione e accodarvi il cliente: come in place_cliente(), la
+ * cassa scelta è ancora aperta e svuoterà la propria coda alla chiusura.
+ * I clienti sono rimossi dalla coda in tempo costante (remove_cliente()) e non
+ * vengono risvegliati: continuano ad attendere di essere serviti dalla nuova
+ * cassa.
+ * Deve essere chiamata dal thread di lavoro di 'cassa', l'unico che estrae i
+ * clienti dalla sua coda: i clienti visitati non possono quindi essere serviti
+ * nè uscire dal supermercato durante la visita, e un cliente in coda non
+ * accede ai propri campi finchè non viene risvegliato.
+ *
+ * Restituisce: il numero di clienti che hanno cambiato coda.
+ */
+int cambia_coda_supermercato(supermercato_t *supermercato, cassiere_t *cassa) {
+  assert(supermercato != NULL && cassa != NULL);
+  if (supermercato->max_cambi == 0) {
+    return 0;
+  }
 
+  int cambi = 0;
+  size_t minima = 0;
+  pthread_mutex_lock_safe(&supermercato->cassieri_mtx);
+  cassiere_t *scelta = coda_piu_corta(supermercato->aperte,
+      supermercato->num_casse, cassa, &minima);
   pthread_mutex_unlock_safe(&supermercato->cassieri_mtx);
 
-  return scelta;
-}
+  size_t posizione = 0; /* clienti che precedono il cliente visitato */
+  ilist_node_t *node = ilist_top(cassa->clienti);
+  while (node != NULL && scelta != NULL) {
+    /* il successivo è letto prima dell'eventuale spostamento del cliente */
+    ilist_node_t *next = ilist_next(cassa->clienti, node);
+    cliente_t *cliente = ilist_entry(node, cliente_t, link);
 
+    if (cambio_conveniente(cliente->queue_changes, supermercato->max_cambi,
+          posizione, minima, supermercato->soglia_cambi)
+        && remove_cliente(cassa, cliente) == 0) {
+      pthread_mutex_lock_safe(&supermercato->cassieri_mtx);
+      /* la cassa scelta potrebbe essere stata chiusa dopo la scelta */
+      scelta = coda_piu_corta(supermercato->aperte, supermercato->num_casse,
+          cassa, &minima);
+      if (scelta != NULL) {
+        /* le statistiche sono aggiornate prima dell'accodamento: da quel
+         * momento il cliente può essere servito e uscire dal supermercato */
+        ++cliente->queue_changes;
+        add_cliente(scelta, cliente);
+        cambi++;
+        /* la coda scelta si è allungata */
+        scelta = coda_piu_corta(supermercato->aperte, supermercato->num_casse,
+            cassa, &minima);
+      }
+      else {
+        /* nessun'altra cassa aperta: il cliente torna in fondo alla coda,
+         * svuotata da questo thread se la cassa è in chiusura */
+        add_cliente(cassa, cliente);
+      }
+      pthread_mutex_unlock_safe(&supermercato->cassieri_mtx);
+    }
+    else {
+      posizione++;
+    }
+    node = next;
+  }
+
+  return cambi;
+}
 
 /*
- * Apre la prima cassa disponibile del supermercato.
+ * Apre la prima cassa disponibile del supermercato, senza attendere che il
+ * cassiere inizi a servire i clienti: 'fatto' (se non NULL) è chiamata con
+ * argomento 'arg' al termine dell'apertura (vedi open_cassa()).
  * Se non ce ne sono, restituisce NULL, altrimenti restituisce il puntatore
  * alla cassa aperta.
  */
-cassiere_t *open_cassa_supermercato(supermercato_t *supermercato) {
+cassiere_t *open_cassa_supermercato(supermercato_t *supermercato,
+    cassa_fatto_t fatto, void *arg) {
   assert(supermercato != NULL);
   assert((int)supermercato->num_casse >= 0);
 
@@ -200,20 +386,17 @@ cassiere_t *open_cassa_supermercato(supermercato_t *supermercato) {
 
   cassiere_t *cassa = NULL;
   /* cerca la prima cassa che rispetta le condizioni per essere aperta */
-  for (uint i=0; i<supermercato->max_casse && cassa == NULL; i++) {
+  for (uint i=0; i<supermercato->max_casse && cassa == NULL
+      && !supermercato->chiuso; i++) {
 
     /* se la cassa non è attiva e non è in chiusura */
     if (!is_cassa_active(&supermercato->cassieri[i]) 
         && !is_cassa_closing(&supermercato->cassieri[i])) {
-      /* mi assicuro che il thread del cassiere sia già stato terminato */
-      pthread_mutex_unlock_safe(&supermercato->cassieri_mtx);
-      wait_cassa(&supermercato->cassieri[i]);
-      pthread_mutex_lock_safe(&supermercato->cassieri_mtx);
-
-      /* quindi apro la cassa */
-      if (open_cassa(&supermercato->cassieri[i]) == 0) {
+      /* il periodo di apertura precedente è terminato: il thread del
+       * cassiere è sospeso, quindi l'apertura non è bloccante */
+      if (open_cassa(&supermercato->cassieri[i], fatto, arg) == 0) {
         cassa = &supermercato->cassieri[i]; /* cassa aperta correttamente */
-        supermercato->num_casse++; /* incrementa il numero di casse aperte */
+        aggiungi_aperta(supermercato, i); /* incrementa il numero di casse aperte */
       }
     }
 
@@ -225,11 +408,15 @@ cassiere_t *open_cassa_supermercato(supermercato_t *supermercato) {
 
 
 /*
- * Chiude la prima cassa tra quelle aperte.
+ * Chiude la prima cassa tra quelle aperte, senza attendere che il cassiere
+ * termini di servire il cliente corrente: la cassa non riceve più clienti e
+ * 'fatto' (se non NULL) è chiamata con argomento 'arg' quando la cassa è
+ * effettivamente chiusa (vedi close_cassa()).
  * Se non ce ne sono, restituisce NULL, altrimenti restituisce il puntatore
- * alla cassa chiusa.
+ * alla cassa in chiusura.
  */
-cassiere_t *close_cassa_supermercato(supermercato_t *supermercato) {
+cassiere_t *close_cassa_supermercato(supermercato_t *supermercato,
+    cassa_fatto_t fatto, void *arg) {
   assert(supermercato != NULL);
   assert((int)supermercato->num_casse >= 0);
 
@@ -240,26 +427,22 @@ cassiere_t *close_cassa_supermercato(supermercato_t *supermercato) {
     return NULL;
   }
 
-  cassiere_t *cassa = NULL;
-  /* cerca la prima cassa che rispetta le condizioni per essere chiusa */
-  for (uint i=0; i<supermercato->max_casse && cassa == NULL; i++) {
-
-    /* se la cassa è attiva e non è in chiusura */
-    if (is_cassa_active(&supermercato->cassieri[i]) 
-        && !is_cassa_closing(&supermercato->cassieri[i])) {
-
-      /* chiudo la cassa */
-      if (close_cassa(&supermercato->cassieri[i]) == 0) {
-        cassa = &supermercato->cassieri[i]; /* cassa correttamente in chiusura */
-        supermercato->num_casse--; /* decrementa il numero di casse aperte */
-
-        /* rilascio il lock per attendere la cassa e non causare deadlock */
-        pthread_mutex_unlock_safe(&supermercato->cassieri_mtx);
-        wait_cassa(&supermercato->cassieri[i]); /* aspetta che la cassa chiuda */
-        pthread_mutex_lock_safe(&supermercato->cassieri_mtx);
-      }
+  /* cerca la prima cassa aperta (con indice minore) nell'indice delle casse
+   * aperte, senza acquisire i mutex dei cassieri */
+  cassiere_t *cassa = supermercato->aperte[0];
+  for (uint i=1; i<supermercato->num_casse; i++) {
+    if (supermercato->aperte[i] < cassa) {
+      cassa = supermercato->aperte[i];
     }
+  }
+  unsigned int i = cassa - supermercato->cassieri;
 
+  /* chiudo la cassa */
+  if (close_cassa(cassa, fatto, arg) == 0) {
+    rimuovi_aperta(supermercato, i); /* decrementa il numero di casse aperte */
+  }
+  else {
+    cassa = NULL;
   }
   pthread_mutex_unlock_safe(&supermercato->cassieri_mtx);
 
@@ -7,8 +7,17 @@
 typedef struct supermercato {
   unsigned int max_casse; /* massimo numero di casse attive */
   unsigned int num_casse; /* numero di casse attive */
+  int chiuso;             /* il supermercato è in chiusura: nessuna cassa può essere aperta */
+  int routing;            /* politica di scelta della cassa (routing_policy) */
+  unsigned int max_cambi; /* massimo numero di cambi di coda volontari (0: disabilitati) */
+  unsigned int soglia_cambi; /* vantaggio minimo di un cambio volontario (JOCKEY_SOGLIA) */
   pthread_mutex_t cassieri_mtx;
   cassiere_t *cassieri;   /* riferimenti ai cassieri del supermercato */
+  /* indice delle casse aperte e non in chiusura, sincronizzato da
+   * cassieri_mtx: aperte[0..num_casse-1] sono le casse attive e posizioni[i]
+   * è la posizione di cassieri[i] in aperte (se attiva) */
+  cassiere_t **aperte;
+  unsigned int *posizioni;
 }supermercato_t;
 
 typedef struct config config_t;
@@ -16,9 +25,17 @@ typedef struct config config_t;
 supermercato_t *create_supermercato(const config_t *config);
 void close_supermercato(supermercato_t *supermercato);
 void free_supermercato(supermercato_t *supermercato);
-cassiere_t *place_cliente(cliente_t *cliente, supermercato_t *supermercato, unsigned int *seed);
-cassiere_t *open_cassa_supermercato(supermercato_t *supermercato);
-cassiere_t *close_cassa_supermercato(supermercato_t *supermercato);
+cassiere_t *place_cliente(cliente_t *cliente, supermercato_t *supermercato, rng_t *rng);
+cassiere_t *scegli_cassa(cassiere_t *const *casse, unsigned int n, int routing, rng_t *rng);
+cassiere_t *coda_piu_corta(cassiere_t *const *casse, unsigned int n,
+    const cassiere_t *esclusa, size_t *minima);
+int cambio_conveniente(unsigned int cambi, unsigned int max_cambi,
+    size_t posizione, size_t lunghezza, unsigned int soglia);
+int cambia_coda_supermercato(supermercato_t *supermercato, cassiere_t *cassa);
+cassiere_t *open_cassa_supermercato(supermercato_t *supermercato,
+    cassa_fatto_t fatto, void *arg);
+cassiere_t *close_cassa_supermercato(supermercato_t *supermercato,
+    cassa_fatto_t fatto, void *arg);
 
 #endif
 
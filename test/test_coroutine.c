@@ -0,0 +1,147 @@
+#include "../coroutine.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define STACK_SIZE (32*1024)
+
+pthread_mutex_t mtx = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t fine_cond = PTHREAD_COND_INITIALIZER;
+int terminate = 0;
+int in_attesa = 0;
+
+/* stato di una coroutine del test */
+typedef struct elemento {
+  coroutine_t co;
+  coroutine_t *attesa; /* coroutine in attesa di 'pronto' */
+  int pronto;
+  int id;
+}elemento_t;
+
+/*
+ * Coroutine: attende un breve intervallo, cede il thread e attende che il
+ * thread principale imposti il proprio flag 'pronto'.
+ */
+void *corpo(void *arg) {
+  elemento_t *e = (elemento_t*) arg;
+  assert(coroutine_self() == &e->co);
+  coroutine_sleep(1 + e->id % 5);
+  assert(coroutine_self() == &e->co);
+  for (int i=0; i<3; i++) {
+    coroutine_yield();
+    assert(coroutine_self() == &e->co);
+  }
+
+  pthread_mutex_lock(&mtx);
+  in_attesa++;
+  pthread_cond_broadcast(&fine_cond);
+  while (!e->pronto) {
+    coroutine_wait(&e->attesa, &mtx);
+  }
+  pthread_mutex_unlock(&mtx);
+  assert(coroutine_self() == &e->co);
+  return (void*)(long) e->id;
+}
+
+void fine(coroutine_t *co, void *result, void *arg) {
+  elemento_t *e = (elemento_t*) co; /* co è il primo campo */
+  assert(arg == NULL);
+  assert((long)result == e->id);
+  assert(coroutine_self() == NULL);
+  pthread_mutex_lock(&mtx);
+  terminate++;
+  pthread_cond_broadcast(&fine_cond);
+  pthread_mutex_unlock(&mtx);
+}
+
+/*
+ * Coroutine: scrive nella pagina di guardia sotto il proprio stack.
+ */
+void *overflow(void *arg) {
+  (void) arg;
+  volatile char *stack = (volatile char*) coroutine_self()->stack;
+  stack[-1] = 0;
+  return NULL;
+}
+
+void fine_overflow(coroutine_t *co, void *result, void *arg) {
+  (void) co;
+  (void) result;
+  (void) arg;
+  exit(EXIT_FAILURE); /* non raggiunta */
+}
+
+int main(int argc, char *argv[]) {
+  assert(argc == 2); /* numero di coroutine */
+
+  int n = atoi(argv[1]);
+  assert(n > 0);
+
+  /* al di fuori di una coroutine le attese bloccano il thread */
+  assert(coroutine_self() == NULL);
+  coroutine_sleep(1);
+  coroutine_yield();
+
+  elemento_t *elementi = (elemento_t*) malloc(sizeof(elemento_t)*n);
+  assert(elementi != NULL);
+
+  coroutine_sched_t *sched = coroutine_sched_create(2, STACK_SIZE);
+  for (int round=0; round<2; round++) {
+    terminate = 0;
+    in_attesa = 0;
+    for (int i=0; i<n; i++) {
+      elementi[i].attesa = NULL;
+      elementi[i].pronto = 0;
+      elementi[i].id = i;
+      coroutine_start(sched, &elementi[i].co, corpo, &elementi[i], fine, NULL);
+    }
+
+    /* tutte le coroutine sono sospese in attesa: nessuna occupa un thread */
+    pthread_mutex_lock(&mtx);
+    while (in_attesa < n) {
+      pthread_cond_wait(&fine_cond, &mtx);
+    }
+    assert(terminate == 0);
+    for (int i=n-1; i>=0; i--) {
+      elementi[i].pronto = 1;
+      coroutine_signal(&elementi[i].attesa);
+      assert(elementi[i].attesa == NULL);
+    }
+    while (terminate < n) {
+      pthread_cond_wait(&fine_cond, &mtx);
+    }
+    pthread_mutex_unlock(&mtx);
+  }
+
+  /* gli stack del secondo round sono quelli allocati nel primo */
+  size_t stacks = 0;
+  pthread_mutex_lock(&sched->mtx);
+  for (void **s = sched->stacks; s != NULL; s = (void**) *s) {
+    stacks++;
+  }
+  pthread_mutex_unlock(&sched->mtx);
+  assert(stacks <= (size_t)n);
+  assert(sched->stack_size >= STACK_SIZE && sched->stack_size % sched->guard_size == 0);
+
+  coroutine_sched_free(sched);
+
+  /* l'accesso alla pagina di guardia termina il processo con SIGSEGV */
+  pid_t pid = fork();
+  assert(pid != -1);
+  if (pid == 0) {
+    sched = coroutine_sched_create(1, STACK_SIZE);
+    coroutine_t co;
+    coroutine_start(sched, &co, overflow, NULL, fine_overflow, NULL);
+    pause();
+    exit(EXIT_FAILURE);
+  }
+  int status;
+  assert(waitpid(pid, &status, 0) == pid);
+  assert(WIFSIGNALED(status) && WTERMSIG(status) == SIGSEGV);
+  free(elementi);
+  exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,93 @@
+#include "../direttore.h"
+#include "../rng.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <pthread.h>
+
+#define CASSE 100
+#define S2 5
+#define THREADS 4
+
+stato_code_t code;
+int comunicazioni;
+
+/* Conta le casse con al più un cliente e con almeno S2 clienti scorrendo
+ * tutte le code */
+aggregati_t conta(stato_code_t *code) {
+  aggregati_t a = { 0, 0 };
+  for (unsigned int i=0; i<code->max_casse; i++) {
+    int n = atomic_load(&code->in_coda[i].n);
+    a.scariche += n <= 1;
+    a.sovraccariche += n >= S2;
+  }
+  return a;
+}
+
+/* Ogni thread comunica le code di un sottoinsieme delle casse; la cassa 0 è
+ * aggiornata da tutti i thread */
+void *cassieri(void *arg) {
+  long id = (long) arg;
+  rng_t rng;
+  rng_init(&rng, RNG_CASSIERI, id);
+  for (int i=0; i<comunicazioni; i++) {
+    unsigned int cassa = id + THREADS*rng_range(&rng, CASSE/THREADS);
+    stato_code_aggiorna(&code, i % 10 ? cassa : 0, rng_range(&rng, 2*S2));
+  }
+  return NULL;
+}
+
+int main(int argc, char *argv[]) {
+  assert(argc == 2); /* numero di comunicazioni */
+
+  comunicazioni = atoi(argv[1]);
+  assert(comunicazioni > 0);
+
+  stato_code_init(&code, CASSE, S2);
+  assert(casse_sovraccariche(&code) == 0);
+  assert(soglia_chiusura(&code, CASSE));
+  assert(!soglia_chiusura(&code, CASSE+1));
+
+  /* gli aggregati aggiornati a ogni comunicazione coincidono con quelli
+   * calcolati scorrendo le code */
+  rng_t rng;
+  rng_init(&rng, RNG_GENERATORE, 0);
+  for (int i=0; i<comunicazioni; i++) {
+    aggregati_t prima = stato_code_aggregati(&code);
+    int cambiati = stato_code_aggiorna(&code, rng_range(&rng, CASSE),
+        rng_range(&rng, 2*S2));
+    aggregati_t a = stato_code_aggregati(&code);
+    aggregati_t attesi = conta(&code);
+    assert(a.scariche == attesi.scariche);
+    assert(a.sovraccariche == attesi.sovraccariche);
+    assert(casse_sovraccariche(&code) == attesi.sovraccariche);
+    assert(soglia_chiusura(&code, attesi.scariche));
+    assert(!soglia_chiusura(&code, attesi.scariche+1));
+    assert(cambiati == (prima.scariche != a.scariche
+          || prima.sovraccariche != a.sovraccariche));
+  }
+
+  /* comunicazioni concorrenti, anche sulla stessa cassa: al termine gli
+   * aggregati sono consistenti con le code */
+  pthread_t threads[THREADS];
+  for (long i=0; i<THREADS; i++) {
+    assert(pthread_create(&threads[i], NULL, cassieri, (void*)i) == 0);
+  }
+  for (int i=0; i<THREADS; i++) {
+    assert(pthread_join(threads[i], NULL) == 0);
+  }
+  aggregati_t a = stato_code_aggregati(&code);
+  aggregati_t attesi = conta(&code);
+  assert(a.scariche == attesi.scariche);
+  assert(a.sovraccariche == attesi.sovraccariche);
+
+  /* code di nuovo vuote */
+  for (unsigned int i=0; i<CASSE; i++) {
+    stato_code_aggiorna(&code, i, 0);
+  }
+  a = stato_code_aggregati(&code);
+  assert(a.scariche == CASSE && a.sovraccariche == 0);
+
+  stato_code_free(&code);
+  exit(EXIT_SUCCESS);
+}
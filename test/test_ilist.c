@@ -0,0 +1,126 @@
+#include "../ilist.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <pthread.h>
+
+#define PRODUTTORI 4
+
+typedef struct elemento {
+  int value;
+  ilist_node_t link;
+}elemento_t;
+
+static int value_of(ilist_node_t *node) {
+  assert(node != NULL);
+  return ilist_entry(node, elemento_t, link)->value;
+}
+
+static ilist_t *list;
+static elemento_t *elementi;
+static int n;
+
+/* Il produttore 'id' inserisce gli elementi id, id + PRODUTTORI, ... */
+static void *produttore(void *arg) {
+  long id = (long) arg;
+  for (int i=id; i<n; i+=PRODUTTORI) {
+    ilist_push(list, &elementi[i].link);
+  }
+  return NULL;
+}
+
+int main(int argc, char *argv[]) {
+  assert(argc == 2);
+
+  n = atoi(argv[1]);
+  assert(n >= 5);
+
+  elementi = (elemento_t*) malloc(sizeof(elemento_t)*n);
+  assert(elementi != NULL);
+
+  list = ilist_create();
+  assert(ilist_empty(list));
+  assert(ilist_pop(list) == NULL);
+  assert(ilist_pop_wait(list, 10) == NULL); /* tempo scaduto */
+  ilist_interrupt(list);
+  assert(ilist_pop_wait(list, 60*1000) == NULL); /* attesa interrotta */
+
+  for (int i=0; i<n; i++) {
+    elementi[i].value = i;
+    ilist_node_init(&elementi[i].link);
+    ilist_push(list, &elementi[i].link);
+    assert(ilist_size(list) == (size_t)(i + 1));
+  }
+  assert(value_of(ilist_top(list)) == 0);
+  /* visita della lista dalla testa */
+  int visitati = 0;
+  for (ilist_node_t *node = ilist_top(list); node != NULL;
+      node = ilist_next(list, node)) {
+    assert(value_of(node) == visitati++);
+  }
+  assert(visitati == n);
+
+  /* rimozione in testa, in mezzo e in coda */
+  assert(ilist_remove(list, &elementi[0].link) == 0);
+  assert(ilist_remove(list, &elementi[n/2].link) == 0);
+  assert(ilist_remove(list, &elementi[n - 1].link) == 0);
+  assert(ilist_remove(list, &elementi[n/2].link) == -1); /* già rimosso */
+  assert(ilist_size(list) == (size_t)(n - 3));
+  assert(value_of(ilist_next(list, &elementi[n/2 - 1].link)) == n/2 + 1);
+  assert(ilist_next(list, &elementi[n - 2].link) == NULL);
+  assert(ilist_next(list, &elementi[n/2].link) == NULL); /* non in lista */
+
+  /* l'ordine FIFO degli elementi rimanenti è preservato */
+  for (int i=1; i<n - 1; i++) {
+    if (i == n/2) {
+      continue;
+    }
+    assert(value_of(ilist_pop_wait(list, 10)) == i);
+    assert(elementi[i].link.list == NULL);
+  }
+  assert(ilist_empty(list));
+
+  /* un nodo estratto può essere reinserito */
+  ilist_push(list, &elementi[0].link);
+  assert(value_of(ilist_pop(list)) == 0);
+  assert(ilist_remove(list, &elementi[0].link) == -1);
+
+  /* estrazione dell'intera lista */
+  assert(ilist_drain(list) == NULL);
+  for (int i=0; i<n; i++) {
+    ilist_push(list, &elementi[i].link);
+  }
+  ilist_node_t *node = ilist_drain(list);
+  assert(ilist_empty(list));
+  for (int i=0; i<n; i++) {
+    assert(value_of(node) == i);
+    assert(elementi[i].link.list == NULL);
+    assert(ilist_remove(list, &elementi[i].link) == -1);
+    node = node->next;
+  }
+  assert(node == NULL);
+
+  /* inserimenti concorrenti: nessun elemento è perso e gli elementi di
+   * ciascun produttore sono estratti nell'ordine di inserimento */
+  pthread_t threads[PRODUTTORI];
+  for (long i=0; i<PRODUTTORI; i++) {
+    assert(pthread_create(&threads[i], NULL, produttore, (void*)i) == 0);
+  }
+  int ultimo[PRODUTTORI];
+  for (int i=0; i<PRODUTTORI; i++) {
+    ultimo[i] = i - PRODUTTORI;
+  }
+  for (int i=0; i<n; i++) {
+    int value = value_of(ilist_pop_wait(list, 60*1000));
+    assert(value == ultimo[value % PRODUTTORI] + PRODUTTORI);
+    ultimo[value % PRODUTTORI] = value;
+  }
+  for (int i=0; i<PRODUTTORI; i++) {
+    assert(pthread_join(threads[i], NULL) == 0);
+  }
+  assert(ilist_empty(list));
+
+  ilist_free(list);
+  free(elementi);
+  exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,108 @@
+#include "../oneshot.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <pthread.h>
+
+#define STACK_SIZE (32*1024)
+
+oneshot_t ping, pong;
+int rounds;
+
+/* Risponde a ogni ping con un pong: ogni evento è atteso e reimpostato
+ * da un solo thread. */
+void *rimbalzo(void *arg) {
+  (void) arg;
+  for (int i=0; i<rounds; i++) {
+    oneshot_wait(&ping);
+    oneshot_reset(&ping);
+    oneshot_set(&pong);
+  }
+  return NULL;
+}
+
+/* stato di una coroutine del test */
+typedef struct elemento {
+  coroutine_t co;
+  oneshot_t evento;
+  int risvegli;
+}elemento_t;
+
+pthread_mutex_t mtx = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t fine_cond = PTHREAD_COND_INITIALIZER;
+int terminate = 0;
+
+void *corpo(void *arg) {
+  elemento_t *e = (elemento_t*) arg;
+  oneshot_wait(&e->evento);
+  assert(coroutine_self() == &e->co);
+  oneshot_reset(&e->evento);
+  e->risvegli++;
+  return NULL;
+}
+
+void fine(coroutine_t *co, void *result, void *arg) {
+  (void) co;
+  (void) result;
+  (void) arg;
+  pthread_mutex_lock(&mtx);
+  terminate++;
+  pthread_cond_broadcast(&fine_cond);
+  pthread_mutex_unlock(&mtx);
+}
+
+int main(int argc, char *argv[]) {
+  assert(argc == 2); /* numero di round e di coroutine */
+
+  rounds = atoi(argv[1]);
+  assert(rounds > 0);
+
+  /* una segnalazione precedente all'attesa non è persa */
+  oneshot_t e;
+  oneshot_init(&e);
+  oneshot_set(&e);
+  oneshot_wait(&e);
+  oneshot_reset(&e);
+  assert(atomic_load(&e.stato) == ONESHOT_VUOTO);
+
+  /* ping-pong tra due thread */
+  oneshot_init(&ping);
+  oneshot_init(&pong);
+  pthread_t thread;
+  assert(pthread_create(&thread, NULL, rimbalzo, NULL) == 0);
+  for (int i=0; i<rounds; i++) {
+    oneshot_set(&ping);
+    oneshot_wait(&pong);
+    oneshot_reset(&pong);
+  }
+  assert(pthread_join(thread, NULL) == 0);
+
+  /* coroutine in attesa, segnalate prima o dopo la sospensione */
+  elemento_t *elementi = (elemento_t*) malloc(sizeof(elemento_t)*rounds);
+  assert(elementi != NULL);
+  coroutine_sched_t *sched = coroutine_sched_create(2, STACK_SIZE);
+  for (int i=0; i<rounds; i++) {
+    oneshot_init(&elementi[i].evento);
+    elementi[i].risvegli = 0;
+    if (i % 2) {
+      oneshot_set(&elementi[i].evento);
+    }
+    coroutine_start(sched, &elementi[i].co, corpo, &elementi[i], fine, NULL);
+  }
+  for (int i=0; i<rounds; i+=2) {
+    oneshot_set(&elementi[i].evento);
+  }
+
+  pthread_mutex_lock(&mtx);
+  while (terminate < rounds) {
+    pthread_cond_wait(&fine_cond, &mtx);
+  }
+  pthread_mutex_unlock(&mtx);
+  for (int i=0; i<rounds; i++) {
+    assert(elementi[i].risvegli == 1);
+  }
+
+  coroutine_sched_free(sched);
+  free(elementi);
+  exit(EXIT_SUCCESS);
+}
@@ -18,6 +18,10 @@ int main(int argc, char *argv[]) {
     assert(config.params[i] != UNDEFINED_PARAM);
     assert(config.params[i] >= 0);
   }
+  assert(config.SPEED > 0);
+  assert(config.ROUTING >= 0 && config.ROUTING < N_ROUTING);
+  assert(config.JOCKEY >= 0);
+  assert(config.JOCKEY_SOGLIA >= 0);
 
   exit(EXIT_SUCCESS);
 }
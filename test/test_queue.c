@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <errno.h>
 
 int main(int argc, char *argv[]) {
   assert(argc > 1);
@@ -29,5 +30,77 @@ int main(int argc, char *argv[]) {
   }
 
   assert(queue_empty(queue));
+  queue_free(queue);
+
+  /* coda con nodi preallocati: i nodi estratti sono riutilizzati */
+  queue = queue_create_sized(1);
+  for (int round=0; round<2; round++) {
+    for (int i=1; i<argc; i++) {
+      queue_push(queue, (void*)argv[i]);
+    }
+    assert(queue_size(queue) == (size_t)(argc - 1));
+    for (int i=1; i<argc; i++) {
+      assert(queue_pop(queue) == (void*)argv[i]);
+    }
+    assert(queue_empty(queue));
+    assert(queue->free_nodes != NULL);
+  }
+  queue_free(queue);
+
+  /* coda limitata: buffer circolare con capacità pari al numero di argomenti */
+  queue = queue_create_bounded(argc - 1);
+  for (int i=1; i<argc; i++) {
+    assert(!queue_full(queue));
+    assert(queue_try_push(queue, (void*)argv[i]) == 0);
+  }
+  assert(queue_full(queue));
+  assert(queue_try_push(queue, (void*)argv[1]) != 0);
+  assert(queue_push_timed(queue, (void*)argv[1], 10) == ETIMEDOUT);
+  assert(queue_size(queue) == (size_t)(argc - 1));
+
+  /* l'estrazione libera un posto: l'inserimento riparte dall'inizio del buffer */
+  assert(queue_pop(queue) == (void*)argv[1]);
+  assert(queue_push_timed(queue, (void*)argv[1], 10) == 0);
+  for (int i=2; i<argc; i++) {
+    assert(queue_top(queue) == (void*)argv[i]);
+    assert(queue_pop(queue) == (void*)argv[i]);
+  }
+  assert(queue_pop(queue) == (void*)argv[1]);
+  assert(queue_empty(queue));
+
+  /* estrazione bloccante con timeout */
+  assert(queue_pop_wait(queue, 10) == NULL);
+  queue_push(queue, (void*)argv[1]);
+  assert(queue_pop_wait(queue, 10) == (void*)argv[1]);
+  queue_free(queue);
+
+  /* inserimento ed estrazione a blocchi */
+  void *values[argc];
+  queue = queue_create();
+  assert(queue_push_batch(queue, (void**)&argv[1], argc - 1) == (size_t)(argc - 1));
+  assert(queue_size(queue) == (size_t)(argc - 1));
+  assert(queue_drain(queue, values, 1) == 1);
+  assert(values[0] == (void*)argv[1]);
+  assert(queue_drain(queue, values, argc) == (size_t)(argc - 2));
+  for (int i=2; i<argc; i++) {
+    assert(values[i - 2] == (void*)argv[i]);
+  }
+  assert(queue_empty(queue));
+  assert(queue_drain(queue, values, argc) == 0);
+  queue_free(queue);
+
+  queue = queue_create_bounded(argc - 1);
+  queue_push(queue, (void*)argv[1]);
+  assert(queue_pop(queue) == (void*)argv[1]); /* il buffer non parte da 0 */
+  assert(queue_push_batch(queue, (void**)&argv[1], argc - 1) == (size_t)(argc - 1));
+  assert(queue_full(queue));
+  assert(queue_push_batch(queue, (void**)&argv[1], 1) == 0); /* coda piena */
+  assert(queue_drain(queue, values, argc) == (size_t)(argc - 1));
+  for (int i=1; i<argc; i++) {
+    assert(values[i - 1] == (void*)argv[i]);
+  }
+  assert(queue_empty(queue));
+  queue_free(queue);
+
   exit(EXIT_SUCCESS);
 }
@@ -0,0 +1,49 @@
+#include "../rng.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#define BUCKETS 10
+
+int main(int argc, char *argv[]) {
+  assert(argc == 2); /* numero di valori generati */
+
+  int n = atoi(argv[1]);
+  assert(n > 0);
+
+  /* stesso seed e stesso flusso: stessa sequenza */
+  rng_t a, b, c;
+  rng_set_seed(42);
+  rng_init(&a, RNG_CLIENTI, 7);
+  rng_init(&b, RNG_CLIENTI, 7);
+  /* flussi diversi: sequenze diverse */
+  rng_init(&c, RNG_CASSIERI, 7);
+  int diversi = 0;
+  for (int i=0; i<n; i++) {
+    uint32_t x = rng_next(&a);
+    assert(x == rng_next(&b));
+    diversi += x != rng_next(&c);
+  }
+  assert(diversi > n/2);
+
+  /* seed diverso: sequenza diversa */
+  rng_set_seed(43);
+  rng_init(&a, RNG_CLIENTI, 7);
+  rng_set_seed(42);
+  rng_init(&c, RNG_CLIENTI, 7);
+  assert(rng_next(&a) != rng_next(&c));
+
+  /* valori nell'intervallo e distribuiti in modo approssimativamente uniforme */
+  int conteggi[BUCKETS] = { 0 };
+  for (int i=0; i<n; i++) {
+    uint32_t x = rng_range(&a, BUCKETS);
+    assert(x < BUCKETS);
+    conteggi[x]++;
+    assert(rng_range(&a, 1) == 0);
+  }
+  for (int i=0; i<BUCKETS; i++) {
+    assert(conteggi[i] > n/BUCKETS/2);
+  }
+
+  exit(EXIT_SUCCESS);
+}
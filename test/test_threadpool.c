@@ -3,28 +3,62 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <pthread.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdatomic.h>
 
-pthread_mutex_t mtx = PTHREAD_MUTEX_INITIALIZER;
-int count = 0;
+atomic_int count = 0; /* letto dal main mentre i job sono in esecuzione */
+threadpool_t *tp;
 
 void* job() {
-  pthread_mutex_lock(&mtx);
   count++;
-  pthread_mutex_unlock(&mtx);
 
   return (void*)0;
 }
 
-int main(int argc, char *argv[]) {
-  assert(argc > 1);
+/* job che attende per un breve intervallo */
+void* sleep_job() {
+  usleep(20*1000);
+  return job();
+}
 
-  int n = atoi(argv[1]);
-  assert(n > 1);
+/* job che attende per un breve intervallo dopo essere stato conteggiato */
+void* slow_job() {
+  job();
+  usleep(20*1000);
+  return (void*)0;
+}
+
+/* job che restituisce il proprio argomento */
+void* echo_job(void *arg) {
+  job();
+  return arg;
+}
 
-  threadpool_t *tp = threadpool_create(5);
+/* job del chiamante che si sottomette nuovamente finchè count < 100 */
+threadpool_job_t self_job;
+void* resubmit_job() {
+  if (job() == (void*)0 && count < 100) {
+    threadpool_add(tp, &self_job);
+  }
+  return (void*)0;
+}
+
+/* job che sottomette a sua volta un job alla stessa pool */
+void* spawn_job() {
+  threadpool_add(tp, threadpool_job_create((void* (*)(void*)) job, NULL, NULL));
+  return job();
+}
+
+/*
+ * Esegue n job, metà dei quali sottomette un ulteriore job se 'spawn' != 0.
+ */
+static void run(threadpool_attr_t *attr, int n, int spawn) {
+  count = 0;
+  tp = threadpool_create_attr(attr);
   for (int i=0; i<n; i++) {
     threadpool_job_t *pool_job = threadpool_job_create(
-        (void* (*)(void*)) job,
+        (void* (*)(void*)) (spawn && i % 2 ? spawn_job : job),
         NULL,
         NULL);
     threadpool_add(tp, pool_job);
@@ -32,8 +66,179 @@ int main(int argc, char *argv[]) {
 
   threadpool_wait(tp, 0);
   threadpool_free(tp);
-  assert(count == n);
-  // printf("COUNT: %d", count);
+  assert(count == (spawn ? n + n/2 : n));
+}
+
+int main(int argc, char *argv[]) {
+  assert(argc > 1);
+
+  int n = atoi(argv[1]);
+  assert(n > 1);
+
+  threadpool_attr_t attr;
+  threadpool_attr_init(&attr, 5);
+  run(&attr, n, 1);
+
+  /* code per thread con work-stealing */
+  attr.work_stealing = 1;
+  run(&attr, n, 1);
+
+  /* Work-stealing con numero di job in attesa limitato.
+   * Nota: un job non può sottomettere altri job a una pool limitata, perchè
+   * tutti i thread potrebbero attendere un posto libero. */
+  attr.max_jobs = 4;
+  run(&attr, n, 0);
+
+  /* sottomissione a blocchi */
+  threadpool_job_t *jobs[n];
+  for (int ws=0; ws<2; ws++) {
+    count = 0;
+    attr.work_stealing = ws;
+    tp = threadpool_create_attr(&attr);
+    for (int i=0; i<n; i++) {
+      jobs[i] = threadpool_job_create((void* (*)(void*)) job, NULL, NULL);
+    }
+    threadpool_add_batch(tp, jobs, n);
+    threadpool_wait(tp, 0);
+    threadpool_free(tp);
+    assert(count == n);
+  }
+
+  /* Future: attesa, attesa limitata e annullamento */
+  count = 0;
+  tp = threadpool_create(1);
+  threadpool_future_t *f1 = threadpool_submit(tp,
+      threadpool_job_create((void* (*)(void*)) sleep_job, NULL, NULL));
+  threadpool_future_t *f2 = threadpool_submit(tp,
+      threadpool_job_create(echo_job, (void*)&count, NULL));
+  void *result = NULL;
+  assert(threadpool_future_timedwait(f2, 1, &result) == ETIMEDOUT);
+  assert(!threadpool_future_done(f2));
+  assert(threadpool_future_wait(f2) == (void*)&count);
+  assert(threadpool_future_timedwait(f2, 0, &result) == 0 && result == (void*)&count);
+  assert(threadpool_future_done(f1) && !threadpool_future_cancelled(f1));
+  assert(threadpool_future_result(f1) == (void*)0);
+  threadpool_future_free(f1);
+  threadpool_future_free(f2);
+
+  f1 = threadpool_submit(tp,
+      threadpool_job_create((void* (*)(void*)) slow_job, NULL, NULL));
+  f2 = threadpool_submit(tp,
+      threadpool_job_create(echo_job, (void*)&count, NULL));
+  while (count < 3) { /* il primo job è in esecuzione */
+    usleep(1000);
+  }
+  threadpool_free(tp); /* il secondo job è scartato */
+  assert(threadpool_future_wait(f1) == (void*)0);
+  assert(threadpool_future_cancelled(f2));
+  assert(threadpool_future_timedwait(f2, 0, NULL) == ECANCELED);
+  threadpool_future_free(f1);
+  threadpool_future_free(f2);
+
+  /* Job e future del chiamante, riutilizzati senza allocazioni */
+  count = 0;
+  tp = threadpool_create(2);
+  threadpool_job_t ojobs[2];
+  threadpool_future_t ofutures[2];
+  for (int i=0; i<2; i++) {
+    threadpool_future_init(&ofutures[i]);
+  }
+  for (int round=0; round<3; round++) {
+    for (int i=0; i<2; i++) {
+      threadpool_job_init(&ojobs[i], echo_job, (void*)&count, NULL);
+      threadpool_job_set_future(&ojobs[i], &ofutures[i]);
+    }
+    threadpool_add(tp, &ojobs[0]);
+    threadpool_add(tp, &ojobs[1]);
+    for (int i=0; i<2; i++) {
+      assert(threadpool_future_wait(&ofutures[i]) == (void*)&count);
+    }
+  }
+  threadpool_free(tp);
+  for (int i=0; i<2; i++) {
+    threadpool_future_destroy(&ofutures[i]);
+  }
+
+  /* Job del chiamante sottomesso nuovamente durante la propria esecuzione */
+  for (int ws=0; ws<2; ws++) {
+    count = 0;
+    threadpool_attr_init(&attr, 4);
+    attr.work_stealing = ws;
+    tp = threadpool_create_attr(&attr);
+    threadpool_job_init(&self_job, (void* (*)(void*)) resubmit_job, NULL, NULL);
+    threadpool_add(tp, &self_job);
+    threadpool_wait(tp, 0);
+    threadpool_free(tp);
+    assert(count == 100);
+  }
+
+  /* Job ritardati: non occupano thread fino alla scadenza */
+  for (int ws=0; ws<2; ws++) {
+    count = 0;
+    threadpool_attr_init(&attr, 2);
+    attr.work_stealing = ws;
+    tp = threadpool_create_attr(&attr);
+    for (int i=0; i<n; i++) {
+      threadpool_add_delayed(tp,
+          threadpool_job_create((void* (*)(void*)) job, NULL, NULL), i % 50);
+    }
+    threadpool_wait(tp, 0);
+    assert(count == n);
+
+    threadpool_job_t *delayed = threadpool_job_create(echo_job, (void*)&count, NULL);
+    f1 = threadpool_job_future(delayed);
+    threadpool_add_delayed(tp, delayed, 200);
+    threadpool_add_delayed(tp, threadpool_job_create((void* (*)(void*)) job, NULL, NULL), 1);
+    threadpool_wait(tp, 1); /* il job più vicino è eseguito per primo */
+    assert(count == n + 1 && !threadpool_future_done(f1));
+    assert(threadpool_future_wait(f1) == (void*)&count);
+    threadpool_future_free(f1);
+
+    /* threadpool_flush_delayed() esegue subito i job non ancora scaduti */
+    delayed = threadpool_job_create(echo_job, (void*)&count, NULL);
+    f1 = threadpool_job_future(delayed);
+    threadpool_add_delayed(tp, delayed, 60*1000);
+    threadpool_flush_delayed(tp);
+    threadpool_wait(tp, 0);
+    assert(threadpool_future_done(f1) && !threadpool_future_cancelled(f1));
+    threadpool_future_free(f1);
+
+    /* un job ritardato non ancora scaduto è scartato */
+    f1 = threadpool_submit(tp, threadpool_job_create((void* (*)(void*)) job, NULL, NULL));
+    threadpool_future_wait(f1);
+    delayed = threadpool_job_create(echo_job, (void*)&count, NULL);
+    f2 = threadpool_job_future(delayed);
+    threadpool_add_delayed(tp, delayed, 60*1000);
+    threadpool_free(tp);
+    assert(threadpool_future_cancelled(f2));
+    threadpool_future_free(f1);
+    threadpool_future_free(f2);
+  }
+
+  /* Pool elastica: parte con un thread, cresce fino a 8 e torna alla
+   * dimensione minima quando i thread restano inattivi. */
+  for (int ws=0; ws<2; ws++) {
+    threadpool_attr_init(&attr, 8);
+    attr.min_size = 1;
+    attr.idle_timeout_ms = 10;
+    attr.stack_size = 64*1024;
+    attr.work_stealing = ws;
+    run(&attr, n, 1);
+
+    tp = threadpool_create_attr(&attr);
+    assert(tp->alive == 1);
+    for (int i=0; i<8; i++) {
+      threadpool_add(tp, threadpool_job_create((void* (*)(void*)) sleep_job, NULL, NULL));
+    }
+    assert(tp->alive > 1 && tp->alive <= 8);
+    threadpool_wait(tp, 0);
+    /* i thread inattivi terminano dopo idle_timeout_ms: attesa al più 5 s */
+    for (int ms=0; tp->alive > 1 && ms < 5000; ms++) {
+      usleep(1000);
+    }
+    assert(tp->alive == 1);
+    threadpool_free(tp);
+  }
 
   exit(EXIT_SUCCESS);
 }
@@ -0,0 +1,77 @@
+#include "../timerwheel.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+int main(int argc, char *argv[]) {
+  assert(argc == 2); /* numero di timer */
+
+  int n = atoi(argv[1]);
+  assert(n > 0);
+
+  timerwheel_t tw;
+  timerwheel_init(&tw, 1000);
+  assert(timerwheel_size(&tw) == 0);
+  assert(timerwheel_advance(&tw, 5000) == NULL);
+  assert(tw.now == 5000);
+
+  /* scadenza già trascorsa: il timer scade al tick successivo */
+  timerwheel_timer_t t;
+  timerwheel_add(&tw, &t, 10);
+  assert(timerwheel_next(&tw) == 5001);
+  assert(timerwheel_advance(&tw, 5001) == &t && t.next == NULL);
+  assert(timerwheel_size(&tw) == 0);
+
+  /* scadenze sparse su tutti i livelli e oltre l'ultimo */
+  timerwheel_timer_t *timers = (timerwheel_timer_t*) malloc(sizeof(timerwheel_timer_t)*n);
+  assert(timers != NULL);
+  unsigned int seed = 0;
+  timerwheel_tick_t start = tw.now;
+  timerwheel_tick_t max_delay = (timerwheel_tick_t)1 << (TIMERWHEEL_BITS*TIMERWHEEL_LEVELS + 1);
+  for (int i=0; i<n; i++) {
+    timerwheel_tick_t delay = 1 + rand_r(&seed) % (i % 2 ? 5000 : max_delay);
+    timerwheel_add(&tw, &timers[i], start + delay);
+    assert(timers[i].expires == start + delay);
+  }
+  assert(timerwheel_size(&tw) == (size_t)n);
+
+  /* i timer rimossi non scadono */
+  for (int i=0; i<n; i+=7) {
+    timerwheel_remove(&tw, &timers[i]);
+  }
+  size_t active = timerwheel_size(&tw);
+
+  /* ogni timer scade esattamente alla propria scadenza, in ordine */
+  size_t expired = 0;
+  while (timerwheel_size(&tw) > 0) {
+    timerwheel_tick_t prev = tw.now;
+    timerwheel_tick_t next = timerwheel_next(&tw);
+    assert(next > prev);
+    timerwheel_tick_t now = next + rand_r(&seed) % 3;
+    timerwheel_tick_t last = prev;
+    for (timerwheel_timer_t *e = timerwheel_advance(&tw, now); e != NULL; e = e->next) {
+      assert(e->expires > prev && e->expires <= now);
+      assert(e->expires >= last);
+      assert((e - timers) % 7 != 0);
+      last = e->expires;
+      expired++;
+    }
+    assert(tw.now == now);
+  }
+  assert(expired == active);
+  assert(timerwheel_next(&tw) == (timerwheel_tick_t)-1);
+
+  /* timer rimossi senza scadere */
+  for (int i=0; i<n; i++) {
+    timerwheel_add(&tw, &timers[i], tw.now + 1 + i);
+  }
+  size_t drained = 0;
+  for (timerwheel_timer_t *e = timerwheel_drain(&tw); e != NULL; e = e->next) {
+    drained++;
+  }
+  assert(drained == (size_t)n);
+  assert(timerwheel_size(&tw) == 0);
+
+  free(timers);
+  exit(EXIT_SUCCESS);
+}
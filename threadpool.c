@@ -1,59 +1,501 @@
 #include "threadpool.h"
 #include "defines.h"
 #include "queue.h"
+#include "rng.h"
 #include <assert.h>
+#include <time.h>
+#include <stddef.h> /* offsetof */
+#include <limits.h>
+
+/*
+ * Coda di job di un thread della pool in modalità work-stealing.
+ * Il thread proprietario estrae i job dal fondo della coda (ordine LIFO: i job
+ * più recenti hanno maggiore probabilità di avere i dati ancora in cache),
+ * mentre gli altri thread sottraggono i job dalla testa. Ogni coda ha un
+ * proprio lock, quindi i thread si contendono lo stesso lock soltanto quando
+ * accedono alla stessa coda.
+ * L'allineamento evita che le code di thread diversi condividano la stessa
+ * linea di cache.
+ */
+typedef struct ws_deque {
+  _Alignas(64) pthread_mutex_t mtx;
+  threadpool_job_t **ring; /* buffer circolare dei job */
+  size_t capacity;         /* dimensione del buffer, cresce se necessario */
+  size_t first;            /* indice del job in testa */
+  atomic_size_t size;      /* numero di job, leggibile senza lock */
+  threadpool_t *tp;        /* pool di appartenenza */
+  rng_t rng;               /* generatore per la scelta delle vittime */
+}ws_deque_t;
+
+/*
+ * Stato di un thread della pool. Un thread terminato per inattività deve
+ * essere atteso con pthread_join() prima che l'elemento sia riutilizzato: vi
+ * provvedono i thread della pool alla scadenza della propria attesa (vedi
+ * reap_locked()), oppure spawn_locked() e threadpool_free().
+ */
+enum { SLOT_FREE, SLOT_RUNNING, SLOT_EXITED };
+
+typedef struct threadpool_slot {
+  pthread_t thread;
+  int state;        /* SLOT_FREE, SLOT_RUNNING o SLOT_EXITED */
+  size_t id;        /* indice dell'elemento (e della coda in work-stealing) */
+  threadpool_t *tp;
+}threadpool_slot_t;
+
+static void *worker(void *arg);
+
+/* Coda del thread corrente, se il thread appartiene a una pool work-stealing */
+static _Thread_local ws_deque_t *local_deque = NULL;
+
+/*
+ * Rilascia un riferimento al future 'future', deallocandolo quando non è più
+ * referenziato nè dal job nè dal chiamante.
+ */
+static void future_release(threadpool_future_t *future) {
+  if (future->external) { /* deallocato dal chiamante */
+    return;
+  }
+  if (atomic_fetch_sub(&future->refs, 1) == 1) {
+    pthread_mutex_destroy(&future->mtx);
+    pthread_cond_destroy(&future->done_cond);
+    free(future);
+  }
+}
+
+/*
+ * Completa il future 'future' con lo stato 'state' e il valore 'result',
+ * risvegliando i thread in attesa dell'esito del job.
+ */
+static void future_complete(threadpool_future_t *future, int state, void *result) {
+  pthread_mutex_lock_safe(&future->mtx);
+  future->result = result;
+  atomic_store(&future->state, state);
+  pthread_cond_broadcast(&future->done_cond);
+  pthread_mutex_unlock_safe(&future->mtx);
+  future_release(future);
+}
 
 /*
  * Rilascia la memoria allocata da un job e chiama la routine di cleanup
- * ad esso associato.
+ * ad esso associato. Se il job non è stato eseguito, il suo future è
+ * completato come annullato.
+ * Un job del chiamante (threadpool_job_init()) non è deallocato e non è più
+ * acceduto dopo la chiamata della routine di cleanup.
  */
 static void threadpool_job_free(threadpool_job_t *job) {
   assert(job != NULL);
-  if (job->cleanup != NULL) {
-    job->cleanup(job->arg);
+  threadpool_future_t *future = job->future;
+  int external = job->external;
+  void (*cleanup)(void*) = job->cleanup;
+  void *arg = job->arg;
+
+  if (!external) {
+    free(job);
+  }
+  if (cleanup != NULL) {
+    cleanup(arg);
+  }
+  if (future != NULL) {
+    future_complete(future, FUTURE_CANCELLED, NULL);
   }
-  free(job);
 }
 
 /*
- * Thread di lavoro dei job sottomessi alla thread pool.
+ * Esegue un job estratto dalla pool, ne rilascia la memoria e segnala il
+ * completamento ai thread in attesa su tp->not_full_cond. Su tp->not_full_cond
+ * attendono thread con predicati diversi (threadpool_wait() su job_count,
+ * ws_reserve() su queued, il generatore dei clienti della simulazione):
+ * è quindi necessario risvegliarli tutti.
+ * Il future del job è completato dopo la routine di cleanup, ma prima che il
+ * job smetta di essere conteggiato in tp->job_count.
+ * Il job non è più acceduto dopo l'inizio della sua esecuzione: un job del
+ * chiamante può essere sottomesso nuovamente dalla sua stessa funzione o da
+ * un altro thread mentre questa è ancora in esecuzione.
+ * Deve essere chiamata senza detenere tp->mtx.
  */
-static void *job_worker(void *arg) {
-  threadpool_t *tp = (threadpool_t*)arg;
+static void threadpool_job_run(threadpool_t *tp, threadpool_job_t *job) {
+  void *(*f)(void*) = job->f;
+  void *arg = job->arg;
+  void (*cleanup)(void*) = job->cleanup;
+  threadpool_future_t *future = job->future;
+  if (future != NULL) {
+    job->future = NULL;
+  }
+  if (!job->external) {
+    free(job);
+  }
+
+  /* esegui job */
+  void *result = f(arg); /* chiamata possibilmente bloccante: necessario rilasciare lock */
+  if (cleanup != NULL) {
+    cleanup(arg);
+  }
+  if (future != NULL) {
+    future_complete(future, FUTURE_DONE, result);
+  }
+
+  pthread_mutex_lock_safe(&tp->mtx);
+  tp->job_count--;
+  pthread_cond_broadcast(&tp->not_full_cond);
+  pthread_mutex_unlock_safe(&tp->mtx);
+}
+
+/*
+ * Inserisce un job in fondo alla coda 'dq', raddoppiando la dimensione del
+ * buffer se questo è pieno.
+ */
+static void ws_deque_push(ws_deque_t *dq, threadpool_job_t *job) {
+  pthread_mutex_lock_safe(&dq->mtx);
+  size_t size = atomic_load_explicit(&dq->size, memory_order_relaxed);
+  if (size == dq->capacity) {
+    size_t capacity = dq->capacity > 0 ? dq->capacity*2 : 16;
+    threadpool_job_t **ring = (threadpool_job_t**) malloc(sizeof(threadpool_job_t*)*capacity);
+    if (ring == NULL) {
+      handle_error("malloc ws_deque_push");
+    }
+    for (size_t i=0; i<size; i++) {
+      ring[i] = dq->ring[(dq->first + i) % dq->capacity];
+    }
+    free(dq->ring);
+    dq->ring = ring;
+    dq->capacity = capacity;
+    dq->first = 0;
+  }
+  dq->ring[(dq->first + size) % dq->capacity] = job;
+  atomic_store_explicit(&dq->size, size + 1, memory_order_release);
+  pthread_mutex_unlock_safe(&dq->mtx);
+}
+
+/*
+ * Estrae il job in fondo alla coda 'dq' (thread proprietario).
+ * Restituisce NULL se la coda è vuota.
+ */
+static threadpool_job_t *ws_deque_pop(ws_deque_t *dq) {
+  threadpool_job_t *job = NULL;
+  pthread_mutex_lock_safe(&dq->mtx);
+  size_t size = atomic_load_explicit(&dq->size, memory_order_relaxed);
+  if (size > 0) {
+    job = dq->ring[(dq->first + size - 1) % dq->capacity];
+    atomic_store_explicit(&dq->size, size - 1, memory_order_release);
+  }
+  pthread_mutex_unlock_safe(&dq->mtx);
+  return job;
+}
+
+/*
+ * Sottrae il job in testa alla coda 'dq' (thread diverso dal proprietario).
+ * Restituisce NULL se la coda è vuota.
+ */
+static threadpool_job_t *ws_deque_steal(ws_deque_t *dq) {
+  /* una coda vuota è ignorata senza acquisire il lock */
+  if (atomic_load_explicit(&dq->size, memory_order_acquire) == 0) {
+    return NULL;
+  }
+
+  threadpool_job_t *job = NULL;
+  pthread_mutex_lock_safe(&dq->mtx);
+  size_t size = atomic_load_explicit(&dq->size, memory_order_relaxed);
+  if (size > 0) {
+    job = dq->ring[dq->first];
+    dq->first = (dq->first + 1) % dq->capacity;
+    atomic_store_explicit(&dq->size, size - 1, memory_order_release);
+  }
+  pthread_mutex_unlock_safe(&dq->mtx);
+  return job;
+}
+
+/*
+ * Crea un nuovo thread della pool, se il numero massimo di thread non è stato
+ * raggiunto.
+ * Deve essere chiamata con tp->mtx acquisito.
+ */
+static void spawn_locked(threadpool_t *tp) {
+  if (tp->stopped || tp->free_count == 0) {
+    return;
+  }
+
+  threadpool_slot_t *slot = &tp->slots[tp->free_slots[--tp->free_count]];
+  if (slot->state == SLOT_EXITED) {
+    /* il thread precedente ha già rilasciato tp->mtx e sta terminando */
+    if (pthread_join(slot->thread, NULL) != 0) {
+      handle_error("threadpool: pthread_join");
+    }
+  }
+  slot->state = SLOT_RUNNING;
+  tp->alive++;
+  if (pthread_create(&slot->thread, &tp->thread_attr, &worker, (void*)slot) != 0) {
+    handle_error("threadpool: pthread_create");
+  }
+}
+
+/*
+ * Crea i thread necessari a eseguire 'pending' job in attesa, dato che 'idle'
+ * thread sono già in attesa di nuovi job.
+ * Deve essere chiamata con tp->mtx acquisito.
+ */
+static void grow_locked(threadpool_t *tp, size_t pending, size_t idle) {
+  while (idle < pending && tp->alive < tp->size && !tp->stopped) {
+    spawn_locked(tp);
+    idle++;
+  }
+}
+
+/*
+ * Attende i thread terminati per inattività i cui elementi non sono ancora
+ * stati riutilizzati, rilasciandone le risorse. Questi hanno già rilasciato
+ * tp->mtx e stanno terminando: l'attesa è breve.
+ * Deve essere chiamata con tp->mtx acquisito e la pool non terminata, in
+ * modo da non attendere thread già attesi da threadpool_free().
+ */
+static void reap_locked(threadpool_t *tp) {
+  for (size_t i=0; i<tp->free_count; i++) {
+    threadpool_slot_t *slot = &tp->slots[tp->free_slots[i]];
+    if (slot->state == SLOT_EXITED) {
+      if (pthread_join(slot->thread, NULL) != 0) {
+        handle_error("threadpool: pthread_join");
+      }
+      slot->state = SLOT_FREE;
+    }
+  }
+}
+
+/*
+ * Determina se il thread corrente, la cui attesa di nuovi job si è conclusa
+ * con codice 'rc', può terminare per inattività. In tal caso rilascia
+ * l'elemento 'slot', che sarà riutilizzato dal prossimo thread creato.
+ * Alla scadenza dell'attesa sono comunque attesi i thread terminati in
+ * precedenza.
+ * Deve essere chiamata con tp->mtx acquisito.
+ * Restituisce: un valore != 0 se il thread deve terminare.
+ */
+static int retire_locked(threadpool_t *tp, threadpool_slot_t *slot, int rc) {
+  if (rc != ETIMEDOUT || tp->stopped) {
+    return 0;
+  }
+  /* al più l'ultimo thread terminato resta da attendere */
+  reap_locked(tp);
+  if (tp->alive <= tp->min_size) {
+    return 0;
+  }
+  slot->state = SLOT_EXITED;
+  tp->free_slots[tp->free_count++] = slot->id;
+  tp->alive--;
+  return 1;
+}
+
+/*
+ * Attende su tp->not_empty_cond la sottomissione di nuovi job. In una pool
+ * elastica l'attesa dura al più tp->idle_timeout_ms millisecondi dall'istante
+ * 'deadline'.
+ * Deve essere chiamata con tp->mtx acquisito.
+ * Restituisce: ETIMEDOUT se l'attesa è scaduta, 0 altrimenti.
+ */
+static int idle_wait_locked(threadpool_t *tp, const struct timespec *deadline) {
+  if (tp->idle_timeout_ms <= 0 || tp->min_size >= tp->size) {
+    pthread_cond_wait(&tp->not_empty_cond, &tp->mtx);
+    return 0;
+  }
+  return pthread_cond_timedwait(&tp->not_empty_cond, &tp->mtx, deadline);
+}
+
+/*
+ * Calcola la scadenza dell'attesa di un thread inattivo.
+ */
+static struct timespec idle_deadline(const threadpool_t *tp) {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  ts.tv_sec += tp->idle_timeout_ms / 1000;
+  ts.tv_nsec += (long)(tp->idle_timeout_ms % 1000)*1000*1000;
+  if (ts.tv_nsec >= 1000*1000*1000) {
+    ts.tv_sec++;
+    ts.tv_nsec -= 1000*1000*1000;
+  }
+  return ts;
+}
+
+/*
+ * Riserva il posto per 'n' nuovi job in modalità work-stealing, incrementando
+ * il numero di job in attesa. Se tale numero è limitato (max_jobs), attende
+ * che vi sia posto per i nuovi job.
+ */
+static void ws_reserve(threadpool_t *tp, size_t n) {
+  if (tp->max_jobs == 0) {
+    atomic_fetch_add(&tp->queued, n);
+    return;
+  }
+
+  pthread_mutex_lock_safe(&tp->mtx);
+  atomic_fetch_add(&tp->full_waiting, 1);
+  atomic_thread_fence(memory_order_seq_cst); /* vedi ws_take() */
+  while (!tp->stopped && atomic_load(&tp->queued) + n > tp->max_jobs) {
+    /* i job già inseriti potrebbero non essere stati notificati (vedi
+     * threadpool_add_batch()) */
+    pthread_cond_broadcast(&tp->not_empty_cond);
+    grow_locked(tp, atomic_load(&tp->queued), atomic_load(&tp->sleeping));
+    pthread_cond_wait(&tp->not_full_cond, &tp->mtx);
+  }
+  atomic_fetch_sub(&tp->full_waiting, 1);
+  atomic_fetch_add(&tp->queued, n);
+  pthread_mutex_unlock_safe(&tp->mtx);
+}
+
+/*
+ * Risveglia i thread in attesa di nuovi job in modalità work-stealing: uno
+ * solo se 'all' == 0, tutti altrimenti. Il lock della pool è acquisito
+ * soltanto se almeno un thread è in attesa.
+ */
+static void ws_wake(threadpool_t *tp, int all) {
+  /* Il fence impedisce che la lettura di sleeping sia anticipata rispetto
+   * all'incremento di queued (ws_reserve()): un thread che si mette in attesa
+   * incrementa sleeping prima di verificare queued, quindi almeno uno dei due
+   * thread osserva la modifica dell'altro (vedi ws_worker()). */
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load_explicit(&tp->sleeping, memory_order_relaxed) > 0) {
+    pthread_mutex_lock_safe(&tp->mtx);
+    if (all) {
+      pthread_cond_broadcast(&tp->not_empty_cond);
+    }
+    else {
+      pthread_cond_signal(&tp->not_empty_cond);
+    }
+    pthread_mutex_unlock_safe(&tp->mtx);
+  }
+}
+
+/*
+ * Cerca un job per il thread proprietario della coda 'self': prima nella
+ * propria coda, poi nelle code degli altri thread a partire da una vittima
+ * scelta a caso.
+ * Restituisce NULL se tutte le code sono vuote.
+ */
+static threadpool_job_t *ws_take(threadpool_t *tp, ws_deque_t *self) {
+  threadpool_job_t *job = ws_deque_pop(self);
+
+  if (job == NULL && tp->size > 1) {
+    size_t id = self - tp->deques;
+    size_t victim = rng_range(&self->rng, tp->size);
+    for (size_t i=0; i<tp->size && job == NULL; i++) {
+      size_t k = (victim + i) % tp->size;
+      if (k != id) {
+        job = ws_deque_steal(&tp->deques[k]);
+      }
+    }
+  }
+
+  if (job != NULL) {
+    atomic_fetch_sub(&tp->queued, 1);
+    /* si è liberato un posto: risveglia chi attende in ws_reserve() */
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&tp->full_waiting, memory_order_relaxed) > 0) {
+      pthread_mutex_lock_safe(&tp->mtx);
+      pthread_cond_broadcast(&tp->not_full_cond);
+      pthread_mutex_unlock_safe(&tp->mtx);
+    }
+  }
+  return job;
+}
+
+/*
+ * Ciclo di lavoro di un thread della pool in modalità work-stealing.
+ */
+static void ws_worker(threadpool_slot_t *slot) {
+  threadpool_t *tp = slot->tp;
+  ws_deque_t *self = &tp->deques[slot->id];
+  local_deque = self;
+
+  while (1) {
+    threadpool_job_t *job = ws_take(tp, self);
+    if (job != NULL) {
+      threadpool_job_run(tp, job);
+      continue;
+    }
+
+    /* Nessun job disponibile: attende la sottomissione di nuovi job.
+     * Nota: queued è incrementato prima dell'inserimento del job nella coda,
+     * quindi il thread può trovare queued > 0 e nessun job per il breve
+     * intervallo che separa le due operazioni. */
+    struct timespec deadline = idle_deadline(tp);
+    int rc = 0;
+    pthread_mutex_lock_safe(&tp->mtx);
+    atomic_fetch_add(&tp->sleeping, 1);
+    atomic_thread_fence(memory_order_seq_cst); /* vedi ws_wake() */
+    while (!tp->stopped && atomic_load(&tp->queued) == 0 && rc != ETIMEDOUT) {
+      rc = idle_wait_locked(tp, &deadline);
+    }
+    atomic_fetch_sub(&tp->sleeping, 1);
+
+    if (tp->stopped) {
+      pthread_cond_broadcast(&tp->not_full_cond);
+      pthread_mutex_unlock_safe(&tp->mtx);
+      break;
+    }
+    if (atomic_load(&tp->queued) == 0 && retire_locked(tp, slot, rc)) {
+      pthread_mutex_unlock_safe(&tp->mtx);
+      break;
+    }
+    pthread_mutex_unlock_safe(&tp->mtx);
+  }
+
+  local_deque = NULL;
+}
+
+/*
+ * Ciclo di lavoro di un thread della pool con coda dei job condivisa.
+ */
+static void job_worker(threadpool_slot_t *slot) {
+  threadpool_t *tp = slot->tp;
 
   pthread_mutex_lock_safe(&tp->mtx);
 
   while (!tp->stopped) {
 
-    while (!tp->stopped && queue_empty(tp->jobs)) {
-      pthread_cond_wait(&tp->not_empty_cond, &tp->mtx);
+    struct timespec deadline = idle_deadline(tp);
+    int rc = 0;
+    tp->idle++;
+    while (!tp->stopped && queue_empty(tp->jobs) && rc != ETIMEDOUT) {
+      rc = idle_wait_locked(tp, &deadline);
     }
+    tp->idle--;
 
     /* mutex locked */
     if (tp->stopped) {
       break;
     }
+    if (queue_empty(tp->jobs)) {
+      if (retire_locked(tp, slot, rc)) {
+        pthread_mutex_unlock_safe(&tp->mtx);
+        return;
+      }
+      continue;
+    }
 
-    assert(!queue_empty(tp->jobs));
     threadpool_job_t *job = (threadpool_job_t*) queue_pop(tp->jobs);
 
     /* mutex unlocked */
     pthread_mutex_unlock_safe(&tp->mtx);
-    /* esegui job */
-    job->f(job->arg); /* chiamata possibilmente bloccante: necessario rilasciare lock */
-    /* rilascia la memoria allocata dal job */
-    threadpool_job_free(job);
+    threadpool_job_run(tp, job);
 
     /* mutex locked */
     pthread_mutex_lock_safe(&tp->mtx);
-    tp->job_count--;
-    pthread_cond_signal(&tp->not_full_cond);
   }
 
   assert(tp->stopped);
-  pthread_cond_signal(&tp->not_full_cond);
+  pthread_cond_broadcast(&tp->not_full_cond);
   pthread_mutex_unlock_safe(&tp->mtx);
-  pthread_exit(0);
+}
+
+/*
+ * Thread di lavoro dei job sottomessi alla thread pool.
+ */
+static void *worker(void *arg) {
+  threadpool_slot_t *slot = (threadpool_slot_t*)arg;
+  if (slot->tp->work_stealing) {
+    ws_worker(slot);
+  }
+  else {
+    job_worker(slot);
+  }
+  return (void*)0;
 }
 
 
@@ -62,7 +504,7 @@ static void *job_worker(void *arg) {
  * argomento 'arg'.
  */
 threadpool_job_t *threadpool_job_create(
-    void *(*f)(void*), 
+    void *(*f)(void*),
     void *arg,
     void (*cleanup)(void*)) {
   threadpool_job_t *tjob = (threadpool_job_t*) malloc(sizeof(threadpool_job_t));
@@ -72,54 +514,449 @@ threadpool_job_t *threadpool_job_create(
 
   assert (f != NULL);
 
-  tjob->f = f;
-  tjob->arg = arg;
-  tjob->cleanup = cleanup;
+  threadpool_job_init(tjob, f, arg, cleanup);
+  tjob->external = 0;
   return tjob;
 }
 
+/*
+ * Inizializza un job la cui memoria è gestita dal chiamante, associandovi il
+ * funzionale 'f' con argomento 'arg'. Il job non è deallocato dalla pool e
+ * può essere reinizializzato e sottomesso nuovamente dopo la chiamata della
+ * routine di cleanup o il completamento del suo future.
+ */
+void threadpool_job_init(
+    threadpool_job_t *job,
+    void *(*f)(void*),
+    void *arg,
+    void (*cleanup)(void*)) {
+  assert(job != NULL && f != NULL);
+  job->f = f;
+  job->arg = arg;
+  job->cleanup = cleanup;
+  job->future = NULL;
+  job->external = 1;
+}
+
+/*
+ * Associa al job 'job', non ancora sottomesso, un future tramite cui
+ * attendere la terminazione del job e ottenerne il valore restituito.
+ * Il future deve essere rilasciato con threadpool_future_free().
+ */
+threadpool_future_t *threadpool_job_future(threadpool_job_t *job) {
+  assert(job != NULL && job->future == NULL);
+  threadpool_future_t *future = (threadpool_future_t*) malloc(sizeof(threadpool_future_t));
+  if (future == NULL) {
+    handle_error("threadpool_job_future malloc");
+  }
+
+  threadpool_future_init(future);
+  future->external = 0;
+  atomic_init(&future->refs, 2); /* job e chiamante */
+  job->future = future;
+  return future;
+}
+
+/*
+ * Associa al job 'job', non ancora sottomesso, il future del chiamante
+ * 'future' (vedi threadpool_future_init()), che non deve essere associato a
+ * un job in attesa o in esecuzione.
+ */
+void threadpool_job_set_future(threadpool_job_t *job, threadpool_future_t *future) {
+  assert(job != NULL && job->future == NULL);
+  assert(future != NULL && future->external);
+  /* il job precedente ha già rilasciato il future: nessun altro thread vi
+   * accede */
+  atomic_store(&future->state, FUTURE_PENDING);
+  future->result = NULL;
+  job->future = future;
+}
+
+/*
+ * Inizializza gli attributi di una threadpool con i valori di default:
+ * 'size' thread sempre attivi, stack di dimensione predefinita e un'unica
+ * coda dei job, condivisa e illimitata.
+ */
+void threadpool_attr_init(threadpool_attr_t *attr, size_t size) {
+  assert(attr != NULL);
+  attr->size = size;
+  attr->min_size = size;
+  attr->idle_timeout_ms = 0;
+  attr->stack_size = 0;
+  attr->max_jobs = 0;
+  attr->work_stealing = 0;
+}
+
 /*
  * Crea una threadpool di dimensione fissa pari a 'size'.
  */
 threadpool_t *threadpool_create(size_t size) {
-  threadpool_t *tp = (threadpool_t*) malloc(sizeof(threadpool_t));
-  pthread_t *threads = (pthread_t*) malloc(sizeof(pthread_t)*size);
+  threadpool_attr_t attr;
+  threadpool_attr_init(&attr, size);
+  return threadpool_create_attr(&attr);
+}
 
-  if (tp == NULL || threads == NULL) {
-    handle_error("threadpool_create malloc");
-  }
+/*
+ * Crea una threadpool con gli attributi 'attr'.
+ * Se attr->max_jobs > 0, i job in attesa sono al più max_jobs e
+ * threadpool_add() si blocca finchè il limite è raggiunto: la memoria occupata
+ * dalla pool rimane costante anche in condizioni di sovraccarico.
+ * Se attr->work_stealing != 0, ogni thread possiede una propria coda di job.
+ * Se attr->min_size < attr->size, la pool è creata con min_size thread e
+ * ne crea di nuovi, fino a size, quando i job in attesa superano i thread
+ * inattivi. Se inoltre attr->idle_timeout_ms > 0, i thread inattivi per più
+ * di idle_timeout_ms millisecondi terminano finchè non ne restano min_size.
+ * Se attr->stack_size > 0, i thread sono creati con uno stack di stack_size
+ * byte invece di quello predefinito.
+ */
+threadpool_t *threadpool_create_attr(const threadpool_attr_t *attr) {
+  assert(attr != NULL);
+  size_t size = attr->size;
   if (size <= 0) {
     return NULL;
   }
+  assert(attr->min_size <= size);
+
+  threadpool_t *tp = (threadpool_t*) malloc(sizeof(threadpool_t));
+  threadpool_slot_t *slots = (threadpool_slot_t*) malloc(sizeof(threadpool_slot_t)*size);
+  size_t *free_slots = (size_t*) malloc(sizeof(size_t)*size);
+
+  if (tp == NULL || slots == NULL || free_slots == NULL) {
+    handle_error("threadpool_create malloc");
+  }
 
   tp->size = size;
-  tp->job_count = 0;
-  tp->jobs = queue_create();
-  tp->threads = threads;
+  tp->min_size = attr->min_size;
+  tp->idle_timeout_ms = attr->idle_timeout_ms;
+  atomic_init(&tp->alive, 0);
+  tp->idle = 0;
+  atomic_init(&tp->job_count, 0);
+  tp->jobs = NULL;
+  tp->work_stealing = attr->work_stealing;
+  tp->max_jobs = attr->max_jobs;
+  tp->deques = NULL;
+  atomic_init(&tp->next_deque, 0);
+  atomic_init(&tp->queued, 0);
+  atomic_init(&tp->sleeping, 0);
+  atomic_init(&tp->full_waiting, 0);
+  tp->timers = NULL; /* allocata alla prima threadpool_add_delayed() */
+  clock_gettime(CLOCK_REALTIME, &tp->epoch);
+  tp->timer_started = 0;
+  tp->timer_stopped = 0;
+  pthread_mutex_init_ec(&tp->timer_mtx, NULL);
+  pthread_cond_init(&tp->timer_cond, NULL);
+
+  if (tp->work_stealing) {
+    tp->deques = (ws_deque_t*) aligned_alloc(64, sizeof(ws_deque_t)*size);
+    if (tp->deques == NULL) {
+      handle_error("threadpool_create malloc");
+    }
+    for (size_t i=0; i<size; i++) {
+      pthread_mutex_init_ec(&tp->deques[i].mtx, NULL);
+      tp->deques[i].ring = NULL;
+      tp->deques[i].capacity = 0;
+      tp->deques[i].first = 0;
+      atomic_init(&tp->deques[i].size, 0);
+      tp->deques[i].tp = tp;
+      rng_init(&tp->deques[i].rng, RNG_THREADPOOL, i);
+    }
+  }
+  else if (attr->max_jobs > 0) {
+    tp->jobs = queue_create_bounded(attr->max_jobs);
+  }
+  else {
+    tp->jobs = queue_create_sized(size); /* evita allocazioni a ogni threadpool_add() */
+  }
+
+  /* gli elementi liberi sono estratti a partire dal primo */
+  tp->slots = slots;
+  tp->free_slots = free_slots;
+  tp->free_count = size;
+  for (size_t i=0; i<size; i++) {
+    slots[i].state = SLOT_FREE;
+    slots[i].id = i;
+    slots[i].tp = tp;
+    free_slots[i] = size - 1 - i;
+  }
+
+  pthread_attr_init(&tp->thread_attr);
+  if (attr->stack_size > 0
+      && pthread_attr_setstacksize(&tp->thread_attr, attr->stack_size) != 0) {
+    handle_error("threadpool_create: pthread_attr_setstacksize");
+  }
+
   tp->stopped = 0;
   pthread_mutex_init_ec(&tp->mtx, NULL);
   pthread_cond_init(&tp->not_full_cond, NULL);
   pthread_cond_init(&tp->not_empty_cond, NULL);
 
-  for (uint i=0; i<size; i++) {
-    pthread_create(&threads[i], NULL, &job_worker, (void*)tp);
+  pthread_mutex_lock_safe(&tp->mtx);
+  for (size_t i=0; i<tp->min_size; i++) {
+    spawn_locked(tp);
   }
+  pthread_mutex_unlock_safe(&tp->mtx);
 
   return tp;
 }
 
+/*
+ * Sceglie la coda in cui inserire un job in modalità work-stealing: la coda
+ * del thread chiamante se questo appartiene alla pool, altrimenti a turno le
+ * code di tutti i thread.
+ */
+static ws_deque_t *ws_target(threadpool_t *tp) {
+  if (local_deque != NULL && local_deque->tp == tp) {
+    return local_deque;
+  }
+  return &tp->deques[atomic_fetch_add(&tp->next_deque, 1) % tp->size];
+}
+
+/*
+ * Crea nuovi thread in modalità work-stealing se i job in attesa superano i
+ * thread inattivi. Il lock della pool è acquisito soltanto se la pool può
+ * ancora crescere.
+ */
+static void ws_grow(threadpool_t *tp) {
+  if (tp->alive < tp->size
+      && atomic_load(&tp->queued) > (size_t)atomic_load(&tp->sleeping)) {
+    pthread_mutex_lock_safe(&tp->mtx);
+    grow_locked(tp, atomic_load(&tp->queued), atomic_load(&tp->sleeping));
+    pthread_mutex_unlock_safe(&tp->mtx);
+  }
+}
+
+/*
+ * Inserisce in coda un job già conteggiato in tp->job_count (vedi
+ * threadpool_add()).
+ */
+static void enqueue(threadpool_t *tp, threadpool_job_t *job) {
+  if (tp->work_stealing) {
+    /* nessun lock condiviso: il job è inserito nella coda di un thread */
+    ws_reserve(tp, 1);
+    ws_deque_push(ws_target(tp), job);
+    ws_wake(tp, 0);
+    ws_grow(tp);
+    return;
+  }
+
+  pthread_mutex_lock_safe(&tp->mtx);
+  if (queue_try_push(tp->jobs, (void*)job) != 0) {
+    /* Coda piena: l'attesa avviene senza detenere tp->mtx, necessario ai
+     * worker per estrarre i job e liberare posti nella coda. */
+    grow_locked(tp, queue_size(tp->jobs), tp->idle);
+    pthread_mutex_unlock_safe(&tp->mtx);
+    queue_push(tp->jobs, (void*)job);
+    pthread_mutex_lock_safe(&tp->mtx);
+  }
+  pthread_cond_broadcast(&tp->not_empty_cond);
+  grow_locked(tp, queue_size(tp->jobs), tp->idle);
+
+  pthread_mutex_unlock_safe(&tp->mtx);
+}
+
 /*
  * Aggiunge un job alla coda della threadpool e notifica i thread attivi in
  * ascolto della presenza di un nuovo lavoro.
+ * Se il numero di job in attesa è limitato e il limite è stato raggiunto, la
+ * chiamata si blocca finchè un thread della pool non estrae un job.
  */
 void threadpool_add(threadpool_t *tp, threadpool_job_t *job) {
-  pthread_mutex_lock_safe(&tp->mtx);
-
-  queue_push(tp->jobs, (void*)job);
+  /* Il job è conteggiato prima di essere inserito in coda, in modo che un
+   * worker non possa completarlo e decrementare job_count prima che questo
+   * sia stato incrementato. */
   tp->job_count++;
-  pthread_cond_broadcast(&tp->not_empty_cond);
+  enqueue(tp, job);
+}
 
-  pthread_mutex_unlock_safe(&tp->mtx);
+/*
+ * Aggiunge un job alla coda della threadpool come threadpool_add().
+ * Restituisce: il future associato al job (vedi threadpool_job_future()).
+ */
+threadpool_future_t *threadpool_submit(threadpool_t *tp, threadpool_job_t *job) {
+  threadpool_future_t *future = threadpool_job_future(job);
+  threadpool_add(tp, job);
+  return future;
+}
+
+/*
+ * Restituisce il job che contiene il timer 'timer'.
+ */
+static threadpool_job_t *timer_job(timerwheel_timer_t *timer) {
+  return (threadpool_job_t*)((char*)timer - offsetof(threadpool_job_t, timer));
+}
+
+/*
+ * Restituisce il tick corrente della timer wheel della pool, cioè i
+ * millisecondi trascorsi da tp->epoch.
+ */
+static timerwheel_tick_t timer_now(const threadpool_t *tp) {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  long long ms = (long long)(ts.tv_sec - tp->epoch.tv_sec)*1000
+    + (ts.tv_nsec - tp->epoch.tv_nsec)/(1000*1000);
+  return ms > 0 ? (timerwheel_tick_t)ms : 0;
+}
+
+/*
+ * Calcola l'istante assoluto corrispondente al tick 'tick'.
+ */
+static struct timespec tick_deadline(const threadpool_t *tp, timerwheel_tick_t tick) {
+  struct timespec ts = tp->epoch;
+  ts.tv_sec += tick / 1000;
+  ts.tv_nsec += (long)(tick % 1000)*1000*1000;
+  if (ts.tv_nsec >= 1000*1000*1000) {
+    ts.tv_sec++;
+    ts.tv_nsec -= 1000*1000*1000;
+  }
+  return ts;
+}
+
+/*
+ * Thread che inserisce in coda i job ritardati alla loro scadenza.
+ * Attende fino al prossimo tick in cui la timer wheel deve avanzare, oppure
+ * finchè non viene sottomesso un job con scadenza anteriore.
+ */
+static void *timer_worker(void *arg) {
+  threadpool_t *tp = (threadpool_t*)arg;
+
+  pthread_mutex_lock_safe(&tp->timer_mtx);
+  while (!tp->timer_stopped) {
+    timerwheel_tick_t next = timerwheel_next(tp->timers);
+    timerwheel_tick_t now = timer_now(tp);
+    if (next == ULLONG_MAX) {
+      pthread_cond_wait(&tp->timer_cond, &tp->timer_mtx);
+      continue;
+    }
+    if (next > now) {
+      struct timespec deadline = tick_deadline(tp, next);
+      pthread_cond_timedwait(&tp->timer_cond, &tp->timer_mtx, &deadline);
+      continue;
+    }
+
+    timerwheel_timer_t *expired = timerwheel_advance(tp->timers, now);
+    /* L'inserimento in coda avviene senza detenere timer_mtx, perchè può
+     * bloccarsi se il numero di job in attesa è limitato. */
+    pthread_mutex_unlock_safe(&tp->timer_mtx);
+    while (expired != NULL) {
+      timerwheel_timer_t *next_timer = expired->next;
+      enqueue(tp, timer_job(expired));
+      expired = next_timer;
+    }
+    pthread_mutex_lock_safe(&tp->timer_mtx);
+  }
+  pthread_mutex_unlock_safe(&tp->timer_mtx);
+  return (void*)0;
+}
+
+/*
+ * Aggiunge un job alla threadpool dopo 'delay_ms' millisecondi.
+ * Fino alla scadenza il job è conservato in una timer wheel e non occupa
+ * alcun thread della pool, ma è conteggiato tra i job sottomessi (vedi
+ * threadpool_wait()). Un job ritardato non ancora scaduto alla chiamata di
+ * threadpool_free() è scartato senza essere eseguito: per eseguirlo comunque
+ * è necessario chiamare prima threadpool_flush_delayed().
+ */
+void threadpool_add_delayed(threadpool_t *tp, threadpool_job_t *job, int delay_ms) {
+  assert(job != NULL);
+  if (delay_ms <= 0) {
+    threadpool_add(tp, job);
+    return;
+  }
+
+  tp->job_count++; /* vedi threadpool_add() */
+
+  pthread_mutex_lock_safe(&tp->timer_mtx);
+  if (!tp->timer_started) {
+    tp->timers = (timerwheel_t*) malloc(sizeof(timerwheel_t));
+    if (tp->timers == NULL) {
+      handle_error("threadpool_add_delayed malloc");
+    }
+    timerwheel_init(tp->timers, timer_now(tp));
+    if (pthread_create(&tp->timer_thread, &tp->thread_attr, &timer_worker, (void*)tp) != 0) {
+      handle_error("threadpool: pthread_create");
+    }
+    tp->timer_started = 1;
+  }
+
+  timerwheel_tick_t now = timer_now(tp);
+  if (timerwheel_size(tp->timers) == 0) {
+    /* il tick della timer wheel non avanza mentre è vuota */
+    timerwheel_advance(tp->timers, now);
+  }
+  timerwheel_tick_t next = timerwheel_next(tp->timers);
+  timerwheel_add(tp->timers, &job->timer, now + delay_ms);
+  if (timerwheel_next(tp->timers) < next) {
+    /* il thread dei timer attende una scadenza successiva */
+    pthread_cond_signal(&tp->timer_cond);
+  }
+  pthread_mutex_unlock_safe(&tp->timer_mtx);
+}
+
+/*
+ * Inserisce immediatamente in coda tutti i job ritardati non ancora scaduti,
+ * come se il loro ritardo fosse trascorso.
+ * Consente di eseguire i job ritardati prima di threadpool_free(), ad esempio
+ * seguita da threadpool_wait(tp, 0), anzichè scartarli.
+ */
+void threadpool_flush_delayed(threadpool_t *tp) {
+  pthread_mutex_lock_safe(&tp->timer_mtx);
+  timerwheel_timer_t *pending = NULL;
+  if (tp->timers != NULL) {
+    pending = timerwheel_drain(tp->timers);
+  }
+  /* inserimento senza timer_mtx, vedi timer_worker() */
+  pthread_mutex_unlock_safe(&tp->timer_mtx);
+  while (pending != NULL) {
+    timerwheel_timer_t *next_timer = pending->next;
+    enqueue(tp, timer_job(pending));
+    pending = next_timer;
+  }
+}
+
+/*
+ * Aggiunge 'n' job alla coda della threadpool con un unico inserimento e
+ * notifica una sola volta i thread in ascolto.
+ * Se il numero di job in attesa è limitato, i job sono inseriti a blocchi
+ * man mano che si libera posto e la chiamata si blocca finchè tutti i job non
+ * sono stati inseriti.
+ */
+void threadpool_add_batch(threadpool_t *tp, threadpool_job_t **jobs, size_t n) {
+  assert(jobs != NULL || n == 0);
+  if (n == 0) {
+    return;
+  }
+
+  tp->job_count += n; /* vedi threadpool_add() */
+
+  if (tp->work_stealing) {
+    /* i job sono distribuiti a turno tra le code dei thread */
+    for (size_t i=0; i<n; i++) {
+      ws_reserve(tp, 1);
+      ws_deque_push(ws_target(tp), jobs[i]);
+    }
+    ws_wake(tp, 1);
+    ws_grow(tp);
+    return;
+  }
+
+  size_t i = 0;
+  while (i < n) {
+    pthread_mutex_lock_safe(&tp->mtx);
+    i += queue_push_batch(tp->jobs, (void**)&jobs[i], n - i);
+    pthread_cond_broadcast(&tp->not_empty_cond);
+    grow_locked(tp, queue_size(tp->jobs), tp->idle);
+    pthread_mutex_unlock_safe(&tp->mtx);
+
+    if (i < n) {
+      /* Coda piena: l'attesa avviene senza detenere tp->mtx (vedi
+       * threadpool_add()). */
+      queue_push(tp->jobs, (void*)jobs[i++]);
+      pthread_mutex_lock_safe(&tp->mtx);
+      pthread_cond_broadcast(&tp->not_empty_cond);
+      grow_locked(tp, queue_size(tp->jobs), tp->idle);
+      pthread_mutex_unlock_safe(&tp->mtx);
+    }
+  }
 }
 
 /*
@@ -141,19 +978,188 @@ void threadpool_wait(threadpool_t *tp, size_t max_jobs) {
  * terminazione di tutti i thread creati.
  */
 void threadpool_free(threadpool_t *tp) {
+  /* Il thread dei timer è terminato per primo: i job che sta inserendo in
+   * coda devono poter essere estratti dai thread della pool. */
+  pthread_mutex_lock_safe(&tp->timer_mtx);
+  tp->timer_stopped = 1;
+  pthread_cond_signal(&tp->timer_cond);
+  pthread_mutex_unlock_safe(&tp->timer_mtx);
+  if (tp->timer_started && pthread_join(tp->timer_thread, NULL) != 0) {
+    handle_error("threadpool_free: pthread_join");
+  }
+
   pthread_mutex_lock_safe(&tp->mtx);
   tp->stopped = 1;
   pthread_cond_broadcast(&tp->not_empty_cond);
   pthread_mutex_unlock_safe(&tp->mtx);
 
-  for(uint i=0; i<tp->size; i++) {
-    if (pthread_join(tp->threads[i], NULL) != 0) {
+  /* Dopo l'impostazione di stopped non sono creati nuovi thread: sono attesi
+   * tutti i thread ancora attivi o terminati per inattività. */
+  for(size_t i=0; i<tp->size; i++) {
+    pthread_mutex_lock_safe(&tp->mtx);
+    int state = tp->slots[i].state;
+    pthread_mutex_unlock_safe(&tp->mtx);
+    if (state != SLOT_FREE && pthread_join(tp->slots[i].thread, NULL) != 0) {
       handle_error("threadpool_free: pthread_join");
     }
   }
-  queue_map((void (*)(void*))threadpool_job_free, tp->jobs);
-  queue_free(tp->jobs);
-  free(tp->threads);
+
+  if (tp->work_stealing) {
+    /* libera i job mai eseguiti rimasti nelle code dei thread */
+    threadpool_job_t *job;
+    for (size_t i=0; i<tp->size; i++) {
+      while ((job = ws_deque_pop(&tp->deques[i])) != NULL) {
+        threadpool_job_free(job);
+      }
+      free(tp->deques[i].ring);
+      pthread_mutex_destroy(&tp->deques[i].mtx);
+    }
+    free(tp->deques);
+  }
+  else {
+    /* Libera i job mai eseguiti: la coda è svuotata a blocchi, acquisendo il
+     * lock una sola volta per blocco. */
+    void *pending[64];
+    size_t n;
+    while ((n = queue_drain(tp->jobs, pending, sizeof(pending)/sizeof(pending[0]))) > 0) {
+      for (size_t i=0; i<n; i++) {
+        threadpool_job_free((threadpool_job_t*) pending[i]);
+      }
+    }
+    queue_free(tp->jobs);
+  }
+  if (tp->timers != NULL) {
+    /* libera i job ritardati non ancora scaduti */
+    timerwheel_timer_t *timer = timerwheel_drain(tp->timers);
+    while (timer != NULL) {
+      timerwheel_timer_t *next_timer = timer->next;
+      threadpool_job_free(timer_job(timer));
+      timer = next_timer;
+    }
+    free(tp->timers);
+  }
+  pthread_mutex_destroy(&tp->timer_mtx);
+  pthread_cond_destroy(&tp->timer_cond);
+  pthread_attr_destroy(&tp->thread_attr);
+  free(tp->slots);
+  free(tp->free_slots);
   free(tp);
 }
 
+/*
+ * Determina, senza bloccarsi, se il job associato al future è terminato o è
+ * stato annullato.
+ * Restituisce: un valore != 0 se l'esito del job è disponibile, 0 altrimenti.
+ */
+int threadpool_future_done(threadpool_future_t *future) {
+  assert(future != NULL);
+  return atomic_load(&future->state) != FUTURE_PENDING;
+}
+
+/*
+ * Determina se il job associato al future è stato scartato senza essere
+ * eseguito.
+ */
+int threadpool_future_cancelled(threadpool_future_t *future) {
+  assert(future != NULL);
+  return atomic_load(&future->state) == FUTURE_CANCELLED;
+}
+
+/*
+ * Restituisce il valore restituito dal job associato al future, che deve
+ * essere terminato (NULL se il job è stato annullato).
+ */
+void *threadpool_future_result(threadpool_future_t *future) {
+  assert(threadpool_future_done(future));
+  pthread_mutex_lock_safe(&future->mtx);
+  void *result = future->result;
+  pthread_mutex_unlock_safe(&future->mtx);
+  return result;
+}
+
+/*
+ * Attende la terminazione del job associato al future.
+ * Restituisce: il valore restituito dal job (NULL se il job è stato
+ * annullato).
+ */
+void *threadpool_future_wait(threadpool_future_t *future) {
+  assert(future != NULL);
+  pthread_mutex_lock_safe(&future->mtx);
+  while (atomic_load(&future->state) == FUTURE_PENDING) {
+    pthread_cond_wait(&future->done_cond, &future->mtx);
+  }
+  void *result = future->result;
+  pthread_mutex_unlock_safe(&future->mtx);
+  return result;
+}
+
+/*
+ * Attende la terminazione del job associato al future per al più
+ * 'timeout_ms' millisecondi. Se il job è terminato e 'result' non è NULL,
+ * vi memorizza il valore restituito dal job.
+ * Restituisce: 0 se il job è terminato, ECANCELED se è stato annullato,
+ * ETIMEDOUT se allo scadere del tempo il job non è ancora terminato.
+ */
+int threadpool_future_timedwait(threadpool_future_t *future, int timeout_ms, void **result) {
+  assert(future != NULL);
+  assert(timeout_ms >= 0);
+
+  struct timespec deadline;
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += timeout_ms / 1000;
+  deadline.tv_nsec += (long)(timeout_ms % 1000)*1000*1000;
+  if (deadline.tv_nsec >= 1000*1000*1000) {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000*1000*1000;
+  }
+
+  pthread_mutex_lock_safe(&future->mtx);
+  while (atomic_load(&future->state) == FUTURE_PENDING) {
+    if (pthread_cond_timedwait(&future->done_cond, &future->mtx, &deadline) == ETIMEDOUT
+        && atomic_load(&future->state) == FUTURE_PENDING) {
+      pthread_mutex_unlock_safe(&future->mtx);
+      return ETIMEDOUT;
+    }
+  }
+  if (result != NULL) {
+    *result = future->result;
+  }
+  int state = atomic_load(&future->state);
+  pthread_mutex_unlock_safe(&future->mtx);
+
+  return state == FUTURE_CANCELLED ? ECANCELED : 0;
+}
+
+/*
+ * Rilascia il future, che non deve essere più utilizzato dal chiamante.
+ * Il future può essere rilasciato anche prima della terminazione del job.
+ */
+void threadpool_future_free(threadpool_future_t *future) {
+  assert(future != NULL && !future->external);
+  future_release(future);
+}
+
+/*
+ * Inizializza un future la cui memoria è gestita dal chiamante.
+ * Il future deve essere distrutto con threadpool_future_destroy() quando
+ * nessun job a cui è associato è in attesa o in esecuzione.
+ */
+void threadpool_future_init(threadpool_future_t *future) {
+  assert(future != NULL);
+  atomic_init(&future->state, FUTURE_PENDING);
+  future->result = NULL;
+  atomic_init(&future->refs, 0);
+  future->external = 1;
+  pthread_mutex_init_ec(&future->mtx, NULL);
+  pthread_cond_init(&future->done_cond, NULL);
+}
+
+/*
+ * Distrugge un future inizializzato con threadpool_future_init(), senza
+ * deallocarne la memoria.
+ */
+void threadpool_future_destroy(threadpool_future_t *future) {
+  assert(future != NULL && future->external);
+  pthread_mutex_destroy(&future->mtx);
+  pthread_cond_destroy(&future->done_cond);
+}
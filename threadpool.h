@@ -2,35 +2,136 @@
 #define THREADPOOL_H
 #include <stdlib.h> /* size_t */
 #include <pthread.h>
+#include <stdatomic.h>
+#include <time.h> /* struct timespec */
+#include "timerwheel.h"
 
 /*
- * Implementazione posix-compliant di una thread pool di dimensione fissa.
+ * Implementazione posix-compliant di una thread pool di dimensione fissa o
+ * elastica. Una pool elastica (threadpool_attr_t.min_size < size) crea nuovi
+ * thread soltanto quando i job in attesa superano i thread inattivi e termina
+ * i thread rimasti inattivi per più di idle_timeout_ms millisecondi.
+ * Di default i job sono inseriti in un'unica coda condivisa da tutti i thread.
+ * In modalità work-stealing (threadpool_attr_t.work_stealing) ogni thread
+ * possiede una propria coda di job: i thread estraggono i job dalla propria
+ * coda e, quando questa è vuota, li sottraggono alle code di altri thread
+ * scelti a caso.
+ * I job sottomessi con threadpool_add_delayed() attendono la propria scadenza
+ * in una timer wheel gestita da un thread dedicato, creato alla prima
+ * sottomissione ritardata, e non occupano alcun thread della pool finchè non
+ * vengono inseriti in coda (alla scadenza o con threadpool_flush_delayed()).
  */
 
 struct queue;
+struct ws_deque;
+struct threadpool_slot;
 
 typedef struct threadpool {
-  size_t size;
-  size_t job_count;
-  struct queue *jobs;
+  size_t size;             /* numero massimo di thread */
+  size_t min_size;         /* numero minimo di thread */
+  int idle_timeout_ms;     /* inattività oltre la quale un thread termina */
+  atomic_size_t alive;     /* numero di thread attivi */
+  size_t idle;             /* thread in attesa di job sulla coda condivisa */
+  atomic_size_t job_count; /* job sottomessi e non ancora terminati */
+  struct queue *jobs;      /* coda condivisa (NULL in modalità work-stealing) */
   pthread_mutex_t mtx;
   pthread_cond_t not_full_cond;
   pthread_cond_t not_empty_cond;
-  pthread_t *threads;
+  struct threadpool_slot *slots; /* un elemento per ogni possibile thread */
+  size_t *free_slots;      /* indici degli elementi di slots inutilizzati */
+  size_t free_count;       /* numero di elementi di free_slots */
+  pthread_attr_t thread_attr;
   int stopped;
+  /* modalità work-stealing */
+  int work_stealing;
+  size_t max_jobs;           /* massimo numero di job in attesa (0 = illimitato) */
+  struct ws_deque *deques;   /* una coda di job per ogni thread */
+  atomic_size_t next_deque;  /* coda per il prossimo job sottomesso dall'esterno */
+  atomic_size_t queued;      /* job in attesa nelle code dei thread */
+  atomic_int sleeping;       /* thread in attesa di nuovi job */
+  atomic_int full_waiting;   /* thread in attesa di un posto (max_jobs) */
+  /* job ritardati (threadpool_add_delayed()) */
+  struct timerwheel *timers; /* job in attesa della scadenza (tick = 1 ms) */
+  struct timespec epoch;     /* istante corrispondente al tick 0 */
+  pthread_t timer_thread;
+  int timer_started;         /* != 0 se timer_thread è stato creato */
+  int timer_stopped;         /* != 0 se timer_thread deve terminare */
+  pthread_mutex_t timer_mtx;
+  pthread_cond_t timer_cond;
 }threadpool_t;
 
+/*
+ * Attributi di creazione di una threadpool (vedi threadpool_attr_init()).
+ */
+typedef struct threadpool_attr {
+  size_t size;         /* numero (massimo) di thread della pool */
+  size_t min_size;     /* numero minimo di thread (min_size < size: elastica) */
+  int idle_timeout_ms; /* inattività oltre la quale un thread termina (0 = mai) */
+  size_t stack_size;   /* dimensione dello stack dei thread (0 = default) */
+  size_t max_jobs;     /* massimo numero di job in attesa (0 = illimitato) */
+  int work_stealing;   /* != 0: una coda di job per thread con work-stealing */
+}threadpool_attr_t;
+
+/*
+ * Esito di un job sottomesso alla pool (vedi threadpool_job_future()).
+ * Il valore restituito dalla funzione del job è disponibile al termine della
+ * sua esecuzione. Un job scartato da threadpool_free() senza essere eseguito
+ * completa il proprio future come annullato.
+ * Un future può anche essere allocato dal chiamante, ad esempio all'interno
+ * di una propria struttura, e inizializzato con threadpool_future_init(): in
+ * tal caso può essere riutilizzato per più job (threadpool_job_set_future())
+ * e non viene mai deallocato dalla pool.
+ */
+enum { FUTURE_PENDING, FUTURE_DONE, FUTURE_CANCELLED };
+
+typedef struct threadpool_future {
+  atomic_int state;        /* FUTURE_PENDING, FUTURE_DONE o FUTURE_CANCELLED */
+  void *result;            /* valore restituito dal job */
+  atomic_int refs;         /* riferimenti: job e chiamante */
+  int external;            /* != 0: memoria gestita dal chiamante */
+  pthread_mutex_t mtx;
+  pthread_cond_t done_cond;
+}threadpool_future_t;
+
+/*
+ * Job sottomesso alla pool. Un job creato con threadpool_job_create() è
+ * deallocato dalla pool dopo l'esecuzione. Un job inizializzato con
+ * threadpool_job_init() appartiene invece al chiamante, che può riutilizzarlo
+ * dopo la chiamata della sua routine di cleanup o il completamento del suo
+ * future: la sottomissione di tali job non effettua allocazioni.
+ * La pool non accede a un job dopo l'inizio della sua esecuzione.
+ */
 typedef struct threadpool_job {
   void *(*f)(void*);
   void *arg;
   void (*cleanup)(void*);
+  threadpool_future_t *future; /* esito del job (NULL se non richiesto) */
+  int external;                /* != 0: memoria gestita dal chiamante */
+  timerwheel_timer_t timer;    /* scadenza (threadpool_add_delayed()) */
 }threadpool_job_t;
 
+void threadpool_attr_init(threadpool_attr_t *attr, size_t size);
 threadpool_t *threadpool_create(size_t size);
+threadpool_t *threadpool_create_attr(const threadpool_attr_t *attr);
 threadpool_job_t *threadpool_job_create(void *(*f)(void*), void *arg, void (*cleanup)(void*));
+void threadpool_job_init(threadpool_job_t *job, void *(*f)(void*), void *arg, void (*cleanup)(void*));
+threadpool_future_t *threadpool_job_future(threadpool_job_t *job);
+void threadpool_job_set_future(threadpool_job_t *job, threadpool_future_t *future);
 void threadpool_add(threadpool_t *tp, threadpool_job_t *job);
+void threadpool_add_delayed(threadpool_t *tp, threadpool_job_t *job, int delay_ms);
+void threadpool_flush_delayed(threadpool_t *tp);
+threadpool_future_t *threadpool_submit(threadpool_t *tp, threadpool_job_t *job);
+void threadpool_add_batch(threadpool_t *tp, threadpool_job_t **jobs, size_t n);
 void threadpool_wait(threadpool_t *tp, size_t max_jobs);
 void threadpool_free(threadpool_t *tp);
+int threadpool_future_done(threadpool_future_t *future);
+int threadpool_future_cancelled(threadpool_future_t *future);
+void *threadpool_future_result(threadpool_future_t *future);
+void *threadpool_future_wait(threadpool_future_t *future);
+int threadpool_future_timedwait(threadpool_future_t *future, int timeout_ms, void **result);
+void threadpool_future_free(threadpool_future_t *future);
+void threadpool_future_init(threadpool_future_t *future);
+void threadpool_future_destroy(threadpool_future_t *future);
 
 
 
@@ -0,0 +1,207 @@
+#include "timerwheel.h"
+#include <limits.h>
+#include <assert.h>
+
+#define SLOT_MASK (TIMERWHEEL_SLOTS - 1)
+
+/*
+ * Inserisce il timer 'timer' in fondo alla lista 'head'.
+ */
+static void list_append(timerwheel_timer_t *head, timerwheel_timer_t *timer) {
+  timer->prev = head->prev;
+  timer->next = head;
+  head->prev->next = timer;
+  head->prev = timer;
+}
+
+/*
+ * Inserisce il timer nella lista del livello più basso che ne contiene la
+ * scadenza. I timer che scadono oltre l'ultimo livello sono inseriti nella
+ * lista più lontana e ridistribuiti quando questa viene raggiunta.
+ * Richiede timer->expires >= tw->now.
+ */
+static void place(timerwheel_t *tw, timerwheel_timer_t *timer) {
+  assert(timer->expires >= tw->now);
+  timerwheel_tick_t delta = timer->expires - tw->now;
+  timerwheel_tick_t expires = timer->expires;
+  int level = 0;
+
+  while (level < TIMERWHEEL_LEVELS - 1
+      && (delta >> (TIMERWHEEL_BITS*(level + 1))) != 0) {
+    level++;
+  }
+  if ((delta >> (TIMERWHEEL_BITS*TIMERWHEEL_LEVELS)) != 0) {
+    expires = tw->now + ((timerwheel_tick_t)1 << (TIMERWHEEL_BITS*TIMERWHEEL_LEVELS)) - 1;
+  }
+
+  size_t index = (expires >> (TIMERWHEEL_BITS*level)) & SLOT_MASK;
+  list_append(&tw->slots[level][index], timer);
+}
+
+/*
+ * Stacca tutti i timer dalla lista 'head', che rimane vuota.
+ * Restituisce: il primo timer della lista (NULL se vuota), collegato ai
+ * successivi tramite il campo next e terminato da NULL.
+ */
+static timerwheel_timer_t *list_detach(timerwheel_timer_t *head) {
+  if (head->next == head) {
+    return NULL;
+  }
+  timerwheel_timer_t *first = head->next;
+  head->prev->next = NULL;
+  head->next = head->prev = head;
+  return first;
+}
+
+/*
+ * Inizializza una timer wheel vuota il cui tick corrente è 'now'.
+ */
+void timerwheel_init(timerwheel_t *tw, timerwheel_tick_t now) {
+  assert(tw != NULL);
+  tw->now = now;
+  tw->count = 0;
+  for (int l=0; l<TIMERWHEEL_LEVELS; l++) {
+    for (int i=0; i<TIMERWHEEL_SLOTS; i++) {
+      tw->slots[l][i].prev = tw->slots[l][i].next = &tw->slots[l][i];
+    }
+  }
+}
+
+/*
+ * Inserisce il timer 'timer', che non deve essere già attivo, con scadenza al
+ * tick 'expires'. Un timer con scadenza non successiva al tick corrente scade
+ * al tick successivo.
+ */
+void timerwheel_add(timerwheel_t *tw, timerwheel_timer_t *timer, timerwheel_tick_t expires) {
+  assert(tw != NULL && timer != NULL);
+  timer->expires = expires > tw->now ? expires : tw->now + 1;
+  place(tw, timer);
+  tw->count++;
+}
+
+/*
+ * Rimuove il timer 'timer', se attivo, senza farlo scadere.
+ */
+void timerwheel_remove(timerwheel_t *tw, timerwheel_timer_t *timer) {
+  assert(tw != NULL && timer != NULL);
+  if (timer->prev == NULL) { /* scaduto o mai inserito */
+    return;
+  }
+  timer->prev->next = timer->next;
+  timer->next->prev = timer->prev;
+  timer->prev = timer->next = NULL;
+  tw->count--;
+}
+
+/*
+ * Avanza il tick corrente fino a 'now', saltando i tick in cui nessun timer
+ * scade e nessuna lista deve essere ridistribuita.
+ * Restituisce: i timer scaduti in ordine di scadenza, collegati tramite il
+ * campo next e terminati da NULL (NULL se nessun timer è scaduto).
+ */
+timerwheel_timer_t *timerwheel_advance(timerwheel_t *tw, timerwheel_tick_t now) {
+  assert(tw != NULL);
+  timerwheel_timer_t *first = NULL;
+  timerwheel_timer_t *last = NULL;
+
+  while (tw->now < now) {
+    if (tw->count == 0) {
+      tw->now = now;
+      break;
+    }
+    timerwheel_tick_t next = timerwheel_next(tw);
+    if (next > now) {
+      tw->now = now;
+      break;
+    }
+    tw->now = next;
+
+    /* ridistribuisce le liste dei livelli superiori il cui intervallo
+     * comincia al tick corrente */
+    for (int l=1; l<TIMERWHEEL_LEVELS; l++) {
+      if ((tw->now & (((timerwheel_tick_t)1 << (TIMERWHEEL_BITS*l)) - 1)) != 0) {
+        break;
+      }
+      size_t index = (tw->now >> (TIMERWHEEL_BITS*l)) & SLOT_MASK;
+      timerwheel_timer_t *timer = list_detach(&tw->slots[l][index]);
+      while (timer != NULL) {
+        timerwheel_timer_t *next_timer = timer->next;
+        place(tw, timer);
+        timer = next_timer;
+      }
+    }
+
+    timerwheel_timer_t *expired = list_detach(&tw->slots[0][tw->now & SLOT_MASK]);
+    while (expired != NULL) {
+      timerwheel_timer_t *next_timer = expired->next;
+      assert(expired->expires == tw->now);
+      expired->prev = NULL;
+      expired->next = NULL;
+      if (last == NULL) {
+        first = expired;
+      }
+      else {
+        last->next = expired;
+      }
+      last = expired;
+      tw->count--;
+      expired = next_timer;
+    }
+  }
+  return first;
+}
+
+/*
+ * Rimuove tutti i timer attivi senza farli scadere.
+ * Restituisce: i timer rimossi, collegati tramite il campo next e terminati
+ * da NULL.
+ */
+timerwheel_timer_t *timerwheel_drain(timerwheel_t *tw) {
+  assert(tw != NULL);
+  timerwheel_timer_t *first = NULL;
+  for (int l=0; l<TIMERWHEEL_LEVELS; l++) {
+    for (int i=0; i<TIMERWHEEL_SLOTS; i++) {
+      timerwheel_timer_t *timer = list_detach(&tw->slots[l][i]);
+      while (timer != NULL) {
+        timerwheel_timer_t *next_timer = timer->next;
+        timer->prev = NULL;
+        timer->next = first;
+        first = timer;
+        timer = next_timer;
+      }
+    }
+  }
+  tw->count = 0;
+  return first;
+}
+
+/*
+ * Restituisce il primo tick successivo a quello corrente in cui un timer
+ * scade o una lista di un livello superiore deve essere ridistribuita, cioè
+ * entro cui è necessario chiamare timerwheel_advance().
+ * Se non ci sono timer attivi restituisce ULLONG_MAX.
+ */
+timerwheel_tick_t timerwheel_next(timerwheel_t *tw) {
+  assert(tw != NULL);
+  if (tw->count == 0) {
+    return ULLONG_MAX;
+  }
+  /* il primo livello contiene soltanto timer che scadono entro
+   * TIMERWHEEL_SLOTS tick: la lista di un tick ne contiene la scadenza esatta */
+  for (timerwheel_tick_t t=tw->now+1; (t & SLOT_MASK) != 0; t++) {
+    timerwheel_timer_t *head = &tw->slots[0][t & SLOT_MASK];
+    if (head->next != head) {
+      return t;
+    }
+  }
+  /* inizio del prossimo intervallo del secondo livello */
+  return ((tw->now >> TIMERWHEEL_BITS) + 1) << TIMERWHEEL_BITS;
+}
+
+/*
+ * Restituisce il numero di timer attivi.
+ */
+size_t timerwheel_size(timerwheel_t *tw) {
+  assert(tw != NULL);
+  return tw->count;
+}
@@ -0,0 +1,45 @@
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+#include <stdlib.h> /* size_t */
+
+/*
+ * Timer wheel gerarchica: TIMERWHEEL_LEVELS livelli di TIMERWHEEL_SLOTS liste
+ * ciascuno. Il livello i contiene i timer che scadono entro
+ * TIMERWHEEL_SLOTS^(i+1) tick e ogni sua lista copre TIMERWHEEL_SLOTS^i tick:
+ * quando il tempo raggiunge l'intervallo di una lista di livello i > 0, i
+ * suoi timer sono ridistribuiti nei livelli inferiori.
+ * Inserimento e rimozione costano O(1) e il collegamento (timerwheel_timer_t)
+ * è contenuto nella struttura dell'elemento, quindi non effettuano
+ * allocazioni.
+ * La struttura non è thread-safe: l'accesso concorrente deve essere
+ * sincronizzato dal chiamante.
+ */
+
+#define TIMERWHEEL_BITS 6
+#define TIMERWHEEL_SLOTS (1 << TIMERWHEEL_BITS)
+#define TIMERWHEEL_LEVELS 4
+
+typedef unsigned long long timerwheel_tick_t;
+
+typedef struct timerwheel_timer {
+  struct timerwheel_timer *prev;
+  struct timerwheel_timer *next;
+  timerwheel_tick_t expires; /* tick di scadenza */
+}timerwheel_timer_t;
+
+typedef struct timerwheel {
+  timerwheel_tick_t now; /* tick corrente */
+  size_t count;          /* numero di timer attivi */
+  /* nodi sentinella di liste circolari */
+  timerwheel_timer_t slots[TIMERWHEEL_LEVELS][TIMERWHEEL_SLOTS];
+}timerwheel_t;
+
+void timerwheel_init(timerwheel_t *tw, timerwheel_tick_t now);
+void timerwheel_add(timerwheel_t *tw, timerwheel_timer_t *timer, timerwheel_tick_t expires);
+void timerwheel_remove(timerwheel_t *tw, timerwheel_timer_t *timer);
+timerwheel_timer_t *timerwheel_advance(timerwheel_t *tw, timerwheel_tick_t now);
+timerwheel_timer_t *timerwheel_drain(timerwheel_t *tw);
+timerwheel_tick_t timerwheel_next(timerwheel_t *tw);
+size_t timerwheel_size(timerwheel_t *tw);
+
+#endif
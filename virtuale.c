@@ -0,0 +1,538 @@
+#include "virtuale.h"
+#include "cassiere.h"
+#include "supermercato.h" /* scegli_cassa(), coda_piu_corta() */
+#include "direttore.h" /* PATIENCE, stato_code_t */
+#include "ilist.h"
+#include "timerwheel.h"
+#include "defines.h"
+#include "logger.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+/*
+ * Simulazione a tempo virtuale.
+ * Il tempo simulato è il tick corrente di un'unica timer wheel, con tick di
+ * un millisecondo, che contiene gli eventi futuri di tutti i clienti e di
+ * tutti i cassieri. Il loop principale salta direttamente al tick del
+ * prossimo evento e lo gestisce, quindi il tempo di esecuzione dipende dal
+ * numero di eventi e non dal tempo simulato.
+ * Gli eventi sono gestiti da un unico thread: le strutture della simulazione
+ * non richiedono sincronizzazione.
+ * Clienti, cassieri e direttore seguono le stesse regole della simulazione in
+ * tempo reale (vedi cliente_worker() e i thread di lavoro di cassieri e direttore).
+ */
+
+enum tipo_evento {
+  EVENTO_ACQUISTI, /* il cliente ha scelto i prodotti */
+  EVENTO_SERVIZIO, /* il cassiere ha servito il cliente corrente */
+  EVENTO_DIRETTORE, /* il cassiere comunica con il direttore */
+  EVENTO_CHIUSURA  /* chiusura del supermercato */
+};
+
+typedef struct evento {
+  timerwheel_timer_t timer; /* primo campo: l'evento è il timer scaduto */
+  int tipo;                 /* tipo_evento */
+  void *soggetto;           /* cliente o cassa a cui si riferisce l'evento */
+  /* eventi scaduti nel tick corrente e non ancora gestiti: un evento può
+   * essere annullato o riprogrammato mentre è in questa lista */
+  int scaduto;
+  struct evento *succ;
+}evento_t;
+
+typedef struct cliente_virtuale {
+  int id;
+  int dwell_time;
+  int products;
+  unsigned int queue_changes;
+  rng_t rng;                      /* generatore per la scelta delle casse */
+  timerwheel_tick_t ingresso;     /* tick di ingresso nel supermercato */
+  timerwheel_tick_t inizio_coda;  /* tick del primo ingresso in coda */
+  int in_coda;                    /* != 0: il cliente si è accodato almeno una volta */
+  ilist_node_t link;              /* collegamento nella coda della cassa */
+  evento_t acquisti;
+}cliente_virtuale_t;
+
+typedef struct cassa_virtuale {
+  cassiere_t cassiere;            /* stato, coda e statistiche della cassa */
+  cliente_virtuale_t *in_servizio; /* cliente in servizio (NULL se libera) */
+  int service_time;               /* tempo di servizio costante del cassiere */
+  timerwheel_tick_t apertura;     /* tick di apertura della cassa */
+  timerwheel_tick_t inizio_servizio; /* tick di inizio servizio del cliente */
+  evento_t servizio;
+  evento_t direttore;
+}cassa_virtuale_t;
+
+typedef struct simulazione {
+  timerwheel_t eventi;            /* eventi futuri, ordinati per tick */
+  const config_t *config;
+  int chiuso;                     /* != 0 dopo la chiusura del supermercato */
+  rng_t rng;                      /* generatore dei clienti (vedi generate_cliente()) */
+  /* casse e direttore */
+  cassa_virtuale_t *casse;
+  uint max_casse;
+  uint num_casse;                 /* casse aperte e non in chiusura */
+  cassiere_t **aperte;            /* casse candidate per l'accodamento */
+  stato_code_t code;              /* ultime comunicazioni dei cassieri */
+  int comunicazioni;              /* comunicazioni dall'ultima decisione */
+  /* clienti */
+  cliente_virtuale_t *clienti;    /* C elementi, allocati alla creazione */
+  cliente_virtuale_t **liberi;    /* elementi di clienti riutilizzabili */
+  size_t num_liberi;
+  size_t presenti;                /* clienti nel supermercato */
+  int prossimo_id;
+  int terminati;
+  int non_serviti;
+}simulazione_t;
+
+/*
+ * Programma l'evento dopo 'ms' millisecondi simulati; l'evento non deve essere
+ * già programmato.
+ */
+static void programma(simulazione_t *sim, evento_t *evento, int tipo, void *soggetto, int ms) {
+  assert(ms > 0);
+  evento->scaduto = 0;
+  evento->tipo = tipo;
+  evento->soggetto = soggetto;
+  timerwheel_add(&sim->eventi, &evento->timer, sim->eventi.now + ms);
+}
+
+/*
+ * Annulla l'evento se programmato, anche se già scaduto ma non ancora gestito.
+ */
+static void annulla(simulazione_t *sim, evento_t *evento) {
+  evento->scaduto = 0;
+  timerwheel_remove(&sim->eventi, &evento->timer);
+}
+
+static void accoda_cliente(simulazione_t *sim, cliente_virtuale_t *cliente);
+
+/*
+ * Inizia a servire il prossimo cliente in coda alla cassa, se presente.
+ */
+static void servi_prossimo(simulazione_t *sim, cassa_virtuale_t *cassa) {
+  assert(cassa->in_servizio == NULL);
+  ilist_node_t *node = ilist_pop(cassa->cassiere.clienti);
+  if (node == NULL) {
+    return;
+  }
+  cliente_virtuale_t *cliente = ilist_entry(node, cliente_virtuale_t, link);
+  atomic_fetch_sub(&cassa->cassiere.prodotti_in_coda, cliente->products);
+  cassa->in_servizio = cliente;
+  cassa->inizio_servizio = sim->eventi.now;
+  programma(sim, &cassa->servizio, EVENTO_SERVIZIO, cassa,
+      cliente->products*cassa->cassiere.tp + cassa->service_time);
+}
+
+/*
+ * Apre la cassa e avvia le comunicazioni periodiche con il direttore.
+ */
+static void apri_cassa(simulazione_t *sim, cassa_virtuale_t *cassa) {
+  assert(!cassa->cassiere.active && !cassa->cassiere.closing);
+  printf("CASSA %d: attivata\n", cassa_id(&cassa->cassiere));
+  /* generazione tempo di servizio casuale nel range 20-80 ms*/
+  cassa->service_time = 20 + rng_range(&cassa->cassiere.rng, 80-20);
+  cassa->cassiere.active = 1;
+  cassa->apertura = sim->eventi.now;
+  sim->num_casse++;
+  programma(sim, &cassa->direttore, EVENTO_DIRETTORE, cassa, cassa->cassiere.s);
+}
+
+/*
+ * Chiude la cassa, che ha terminato di servire il cliente corrente: i
+ * clienti in coda cercano un'altra cassa aperta.
+ */
+static void chiudi_cassa(simulazione_t *sim, cassa_virtuale_t *cassa) {
+  assert(cassa->cassiere.active && cassa->in_servizio == NULL);
+  cassiere_t *cassiere = &cassa->cassiere;
+  cassiere->active = 0;
+  cassiere->closing = 0;
+  cassiere->numero_chiusure++;
+
+  int parziale = (int)(sim->eventi.now - cassa->apertura);
+  log_write("CASSA %d: tempo parziale di apertura = %.3f\n",
+      cassa_id(cassiere), (double)parziale/1000);
+  cassiere->tempo_totale += parziale;
+  if (cassiere->clienti_serviti > 0) {
+    cassiere->tempo_medio /= cassiere->clienti_serviti;
+  }
+
+  ilist_node_t *node = ilist_drain(cassiere->clienti);
+  atomic_store(&cassiere->prodotti_in_coda, 0);
+  while (node != NULL) {
+    ilist_node_t *next = node->next; /* il nodo può essere reinserito */
+    accoda_cliente(sim, ilist_entry(node, cliente_virtuale_t, link));
+    node = next;
+  }
+}
+
+/*
+ * Segnala la chiusura alla cassa, che chiude dopo aver servito il cliente
+ * corrente (vedi close_cassa()).
+ */
+static void richiedi_chiusura(simulazione_t *sim, cassa_virtuale_t *cassa) {
+  assert(cassa->cassiere.active && !cassa->cassiere.closing);
+  annulla(sim, &cassa->direttore); /* la cassa non comunica più con il direttore */
+  sim->num_casse--;
+  if (cassa->in_servizio == NULL) {
+    chiudi_cassa(sim, cassa);
+  }
+  else {
+    cassa->cassiere.closing = 1;
+  }
+}
+
+/*
+ * Decisione del direttore dopo la comunicazione di un cassiere
+ * (vedi direttore_worker()).
+ */
+static void decidi_direttore(simulazione_t *sim) {
+  int da_aprire = casse_sovraccariche(&sim->code);
+  if (sim->comunicazioni >= PATIENCE && da_aprire > 0) {
+    /* una nuova cassa per ogni cassa sovraccarica */
+    for (uint i=0; i<sim->max_casse && da_aprire > 0; i++) {
+      cassiere_t *cassiere = &sim->casse[i].cassiere;
+      if (!cassiere->active && !cassiere->closing) {
+        apri_cassa(sim, &sim->casse[i]);
+        printf("DIRETTORE: Aprendo cassa %d.\n", cassa_id(cassiere));
+        da_aprire--;
+      }
+    }
+    sim->comunicazioni = 0;
+  }
+  if (sim->comunicazioni >= PATIENCE
+      && soglia_chiusura(&sim->code, sim->config->params[S1])) {
+    for (uint i=0; i<sim->max_casse; i++) {
+      cassiere_t *cassiere = &sim->casse[i].cassiere;
+      if (cassiere->active && !cassiere->closing) {
+        printf("DIRETTORE: Chiudendo cassa %d.\n", cassa_id(cassiere));
+        stato_code_aggiorna(&sim->code, i, 0);
+        richiedi_chiusura(sim, &sim->casse[i]);
+        break;
+      }
+    }
+    sim->comunicazioni = 0;
+  }
+}
+
+/*
+ * Fa entrare un nuovo cliente nel supermercato, con gli stessi parametri
+ * casuali di generate_cliente().
+ */
+static void entra_cliente(simulazione_t *sim) {
+  assert(sim->num_liberi > 0);
+  cliente_virtuale_t *cliente = sim->liberi[--sim->num_liberi];
+  cliente->id = sim->prossimo_id++;
+  cliente->products = rng_range(&sim->rng, sim->config->params[P]);
+  cliente->dwell_time = 10 + rng_range(&sim->rng, sim->config->params[T] - 10);
+  cliente->queue_changes = 0;
+  rng_init(&cliente->rng, RNG_CLIENTI, cliente->id);
+  cliente->ingresso = sim->eventi.now;
+  cliente->in_coda = 0;
+  ilist_node_init(&cliente->link);
+  sim->presenti++;
+  programma(sim, &cliente->acquisti, EVENTO_ACQUISTI, cliente, cliente->dwell_time);
+}
+
+/*
+ * Fa uscire il cliente dal supermercato, dopo aver acquistato 'prodotti'
+ * prodotti, e ne fa entrare altri E se i clienti presenti scendono sotto la
+ * soglia C - E.
+ */
+static void esci_cliente(simulazione_t *sim, cliente_virtuale_t *cliente, int prodotti, int servito) {
+  timerwheel_tick_t now = sim->eventi.now;
+  log_write("CLIENTE %d: prodotti acquistati = %d\n", cliente->id, prodotti);
+  log_write("CLIENTE %d: tempo totale = %.3f\n", cliente->id,
+      (double)(now - cliente->ingresso)/1000);
+  log_write("CLIENTE %d: tempo in coda = %.3f\n", cliente->id,
+      cliente->in_coda ? (double)(now - cliente->inizio_coda)/1000 : 0.0);
+  log_write("CLIENTE %d: cambi di coda = %d \n", cliente->id, cliente->queue_changes);
+  log_write("CLIENTE %d: Liberando memoria\n", cliente->id);
+
+  sim->terminati++;
+  if (!servito) {
+    sim->non_serviti++;
+  }
+  sim->presenti--;
+  sim->liberi[sim->num_liberi++] = cliente;
+
+  size_t max_clienti = sim->config->params[C];
+  int e = sim->config->params[E];
+  if (!sim->chiuso && sim->presenti <= max_clienti - e) {
+    for (int i=0; i<e; i++) {
+      entra_cliente(sim);
+    }
+  }
+}
+
+/*
+ * Raccoglie in sim->aperte le casse aperte e non in chiusura, candidate per
+ * l'accodamento dei clienti.
+ * Restituisce: il numero di casse raccolte.
+ */
+static uint casse_aperte(simulazione_t *sim) {
+  uint n = 0;
+  for (uint i=0; i<sim->max_casse; i++) {
+    if (sim->casse[i].cassiere.active && !sim->casse[i].cassiere.closing) {
+      sim->aperte[n++] = &sim->casse[i].cassiere;
+    }
+  }
+  assert(n == sim->num_casse);
+  return n;
+}
+
+/*
+ * Accoda il cliente a una cassa aperta scelta secondo la politica di routing
+ * (vedi place_cliente()); se non ce ne sono il cliente esce non servito.
+ */
+static void accoda_cliente(simulazione_t *sim, cliente_virtuale_t *cliente) {
+  if (sim->num_casse == 0) {
+    log_write("CLIENTE %d: terminato per mancanza di casse aperte\n", cliente->id);
+    esci_cliente(sim, cliente, 0, 0);
+    return;
+  }
+
+  /* sceglie una delle casse aperte secondo la politica configurata */
+  uint n = casse_aperte(sim);
+  cassa_virtuale_t *scelta = ilist_entry(
+      scegli_cassa(sim->aperte, n, sim->config->ROUTING, &cliente->rng),
+      cassa_virtuale_t, cassiere);
+
+  if (!cliente->in_coda) {
+    cliente->in_coda = 1;
+    cliente->inizio_coda = sim->eventi.now;
+  }
+  else {
+    ++cliente->queue_changes;
+  }
+  atomic_fetch_add(&scelta->cassiere.prodotti_in_coda, cliente->products);
+  ilist_push(scelta->cassiere.clienti, &cliente->link);
+  if (scelta->in_servizio == NULL) {
+    servi_prossimo(sim, scelta);
+  }
+}
+
+/*
+ * Jockeying (vedi cambia_coda_supermercato()): ogni cliente in coda alla
+ * cassa passa alla coda più corta tra le altre casse aperte, secondo la
+ * politica comune alla simulazione in tempo reale (vedi coda_piu_corta() e
+ * cambio_conveniente()).
+ * Restituisce: il numero di clienti che hanno cambiato coda.
+ */
+static int cambia_coda(simulazione_t *sim, cassa_virtuale_t *cassa) {
+  /* le casse aperte non cambiano durante la visita */
+  uint n = casse_aperte(sim);
+  int cambi = 0;
+  size_t minima = 0;
+  cassiere_t *scelta = coda_piu_corta(sim->aperte, n, &cassa->cassiere, &minima);
+  size_t posizione = 0; /* clienti che precedono il cliente visitato */
+  ilist_node_t *node = ilist_top(cassa->cassiere.clienti);
+  while (node != NULL && scelta != NULL) {
+    ilist_node_t *next = node->next; /* letto prima dello spostamento */
+    cliente_virtuale_t *cliente = ilist_entry(node, cliente_virtuale_t, link);
+
+    if (cambio_conveniente(cliente->queue_changes, sim->config->JOCKEY,
+          posizione, minima, sim->config->JOCKEY_SOGLIA)) {
+      cassa_virtuale_t *nuova = ilist_entry(scelta, cassa_virtuale_t, cassiere);
+      ilist_remove(cassa->cassiere.clienti, &cliente->link);
+      atomic_fetch_sub(&cassa->cassiere.prodotti_in_coda, cliente->products);
+      atomic_fetch_add(&nuova->cassiere.prodotti_in_coda, cliente->products);
+      ++cliente->queue_changes;
+      ilist_push(nuova->cassiere.clienti, &cliente->link);
+      if (nuova->in_servizio == NULL) {
+        servi_prossimo(sim, nuova);
+      }
+      cambi++;
+      scelta = coda_piu_corta(sim->aperte, n, &cassa->cassiere, &minima);
+    }
+    else {
+      posizione++;
+    }
+    node = next;
+  }
+  return cambi;
+}
+
+static void gestisci_evento(simulazione_t *sim, evento_t *evento) {
+  cliente_virtuale_t *cliente;
+  cassa_virtuale_t *cassa;
+
+  switch (evento->tipo) {
+    case EVENTO_ACQUISTI:
+      cliente = (cliente_virtuale_t*) evento->soggetto;
+      log_write("CLIENTE %d: terminato di scegliere gli acquisti dopo %.3f s \n",
+          cliente->id, (double)cliente->dwell_time/1000);
+      if (cliente->products == 0) {
+        esci_cliente(sim, cliente, 0, 1);
+      }
+      else {
+        accoda_cliente(sim, cliente);
+      }
+      break;
+
+    case EVENTO_SERVIZIO:
+      cassa = (cassa_virtuale_t*) evento->soggetto;
+      cliente = cassa->in_servizio;
+      assert(cliente != NULL);
+      cassa->in_servizio = NULL;
+      cassa->cassiere.clienti_serviti++;
+      cassa->cassiere.prodotti_venduti += cliente->products;
+      int t = (int)(sim->eventi.now - cassa->inizio_servizio);
+      log_write("CASSA %d: tempo di servizio cliente = %.3f\n",
+          cassa_id(&cassa->cassiere), (double)t/1000);
+      cassa->cassiere.tempo_medio += t;
+      esci_cliente(sim, cliente, cliente->products, 1);
+
+      if (cassa->cassiere.closing) {
+        chiudi_cassa(sim, cassa);
+      }
+      else {
+        servi_prossimo(sim, cassa);
+      }
+      break;
+
+    case EVENTO_DIRETTORE:
+      cassa = (cassa_virtuale_t*) evento->soggetto;
+      assert(cassa->cassiere.active && !cassa->cassiere.closing);
+      if (sim->config->JOCKEY > 0) {
+        cambia_coda(sim, cassa);
+      }
+      if (!sim->chiuso) {
+        stato_code_aggiorna(&sim->code, cassa - sim->casse,
+            ilist_size(cassa->cassiere.clienti));
+        sim->comunicazioni++;
+        decidi_direttore(sim);
+      }
+      /* la comunicazione può aver chiuso la cassa stessa */
+      if (cassa->cassiere.active && !cassa->cassiere.closing) {
+        programma(sim, &cassa->direttore, EVENTO_DIRETTORE, cassa, cassa->cassiere.s);
+      }
+      break;
+
+    case EVENTO_CHIUSURA:
+      /* Come alla ricezione di SIGQUIT: i clienti che stanno scegliendo i
+       * prodotti non escono, le casse chiudono dopo aver servito il cliente
+       * corrente e i clienti in coda escono non serviti. */
+      printf("Supermercato in chiusura \n");
+      sim->chiuso = 1;
+      for (size_t i=0; i<(size_t)sim->config->params[C]; i++) {
+        annulla(sim, &sim->clienti[i].acquisti);
+      }
+      for (uint i=0; i<sim->max_casse; i++) {
+        if (sim->casse[i].cassiere.active && !sim->casse[i].cassiere.closing) {
+          richiedi_chiusura(sim, &sim->casse[i]);
+        }
+      }
+      break;
+
+    default:
+      assert(0);
+  }
+}
+
+void simulazione_virtuale(const config_t *config, unsigned long long durata) {
+  assert(config != NULL);
+  const int *params = config->params;
+  assert(params[K] >= params[I] && params[I] >= 0);
+  assert(params[C] > 0 && params[E] > 0 && params[E] <= params[C]);
+  assert(params[P] > 0 && params[T] > 10 && params[S] > 0);
+
+  log_setfile(config->LOG);
+
+  simulazione_t *sim = (simulazione_t*) malloc(sizeof(simulazione_t));
+  if (sim == NULL) {
+    handle_error("malloc simulazione");
+  }
+  timerwheel_init(&sim->eventi, 0);
+  sim->config = config;
+  sim->chiuso = 0;
+  rng_init(&sim->rng, RNG_GENERATORE, 0); /* come il generatore dei clienti */
+  sim->max_casse = params[K];
+  sim->num_casse = 0;
+  sim->comunicazioni = 0;
+  sim->num_liberi = 0;
+  sim->presenti = 0;
+  sim->prossimo_id = 0;
+  sim->terminati = 0;
+  sim->non_serviti = 0;
+
+  sim->casse = (cassa_virtuale_t*) malloc(sizeof(cassa_virtuale_t)*sim->max_casse);
+  sim->aperte = (cassiere_t**) malloc(sizeof(cassiere_t*)*sim->max_casse);
+  sim->clienti = (cliente_virtuale_t*) calloc(params[C], sizeof(cliente_virtuale_t));
+  sim->liberi = (cliente_virtuale_t**) malloc(sizeof(cliente_virtuale_t*)*params[C]);
+  if (sim->casse == NULL || sim->aperte == NULL
+      || sim->clienti == NULL || sim->liberi == NULL) {
+    handle_error("malloc simulazione");
+  }
+  for (int i=params[C]-1; i>=0; i--) {
+    sim->liberi[sim->num_liberi++] = &sim->clienti[i];
+  }
+  stato_code_init(&sim->code, sim->max_casse, params[S2]);
+
+  for (uint i=0; i<sim->max_casse; i++) {
+    init_cassiere(&sim->casse[i].cassiere, params[TP], params[S]);
+    sim->casse[i].in_servizio = NULL;
+    sim->casse[i].servizio.timer.prev = NULL;
+    sim->casse[i].direttore.timer.prev = NULL;
+  }
+  for (int i=0; i<params[I]; i++) {
+    apri_cassa(sim, &sim->casse[i]);
+  }
+
+  evento_t chiusura;
+  programma(sim, &chiusura, EVENTO_CHIUSURA, NULL, durata > 0 ? durata : 1);
+
+  /* Creazione iniziale di C clienti */
+  for (int i=0; i<params[C]; i++) {
+    entra_cliente(sim);
+  }
+
+  /* Loop degli eventi: il tempo simulato avanza fino al prossimo evento.
+   * Gli eventi scaduti sono collegati tramite il campo succ prima di essere
+   * gestiti, perchè la gestione di un evento può riprogrammarne un altro
+   * scaduto nello stesso tick (e quindi modificarne il campo timer.next). */
+  while (timerwheel_size(&sim->eventi) > 0) {
+    evento_t *scaduti = NULL, **ultimo = &scaduti;
+    timerwheel_timer_t *timer = timerwheel_advance(&sim->eventi,
+        timerwheel_next(&sim->eventi));
+    for (; timer != NULL; timer = timer->next) {
+      evento_t *evento = (evento_t*) timer;
+      evento->scaduto = 1;
+      evento->succ = NULL;
+      *ultimo = evento;
+      ultimo = &evento->succ;
+    }
+    for (evento_t *evento = scaduti; evento != NULL; evento = evento->succ) {
+      if (evento->scaduto) { /* non annullato nè riprogrammato */
+        evento->scaduto = 0;
+        gestisci_evento(sim, evento);
+      }
+    }
+  }
+  assert(sim->num_casse == 0);
+
+  /* Logging statistiche supermercato (vedi close_supermercato()) */
+  int totale_prodotti = 0;
+  int totale_serviti = 0;
+  for (uint i=0; i<sim->max_casse; i++) {
+    log_cassiere(&sim->casse[i].cassiere);
+    totale_prodotti += sim->casse[i].cassiere.prodotti_venduti;
+    totale_serviti += sim->casse[i].cassiere.clienti_serviti;
+  }
+  log_write("SUPERMERCATO: prodotti venduti = %d\n", totale_prodotti);
+  log_write("SUPERMERCATO: clienti serviti = %d\n", totale_serviti);
+  log_write("SUPERMERCATO: clienti terminati = %d\n", sim->terminati);
+  log_write("SUPERMERCATO: clienti non serviti = %d\n", sim->non_serviti);
+
+  for (uint i=0; i<sim->max_casse; i++) {
+    ilist_free(sim->casse[i].cassiere.clienti);
+    pthread_mutex_destroy(&sim->casse[i].cassiere.mtx);
+  }
+  log_close();
+  free(sim->casse);
+  stato_code_free(&sim->code);
+  free(sim->aperte);
+  free(sim->clienti);
+  free(sim->liberi);
+  free(sim);
+}
@@ -0,0 +1,16 @@
+#ifndef VIRTUALE_H
+#define VIRTUALE_H
+#include "parser.h"
+
+/*
+ * Simulazione a tempo virtuale (opzione -v): clienti, cassieri e direttore
+ * sono eseguiti da un unico thread come eventi ordinati per tempo simulato,
+ * quindi i tempi di acquisto, di servizio e di comunicazione con il direttore
+ * trascorrono istantaneamente.
+ * La configurazione e il file di log sono gli stessi della simulazione in
+ * tempo reale; dopo 'durata' millisecondi simulati il supermercato chiude
+ * come alla ricezione di un segnale SIGQUIT.
+ */
+void simulazione_virtuale(const config_t *config, unsigned long long durata);
+
+#endif